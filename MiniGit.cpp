@@ -1,8 +1,30 @@
 #include <iostream>
 #include <string>
 #include <set>
+#include <vector>
+#include <chrono>
+#include <unordered_set>
+#include <map>
+#include <deque>
+#include "trace.cpp"
 #include "fileUtils.cpp"
+#include "threadPool.cpp"
+#include "hashEngine.cpp"
+#include "repoConfig.cpp"
+#include "encoding.cpp"
 #include "commitList.cpp"
+#include "indexFile.cpp"
+#include "compression.cpp"
+#include "delta.cpp"
+#include "chunker.cpp"
+#include "packFile.cpp"
+#include "objectIndex.cpp"
+#include "objectStore.cpp"
+#include "treeObject.cpp"
+#include "packedRefs.cpp"
+#include "commitGraph.cpp"
+#include "diffEngine.cpp"
+#include "merge3.cpp"
 
 using namespace std;
 
@@ -12,6 +34,29 @@ const string STAGING_AREA = MINIGIT_DIR + "index";
 const string REFS_DIR = MINIGIT_DIR + "refs/";
 const string HEAD_DIR = REFS_DIR + "heads/";
 const string HEAD_FILE = MINIGIT_DIR + "HEAD";
+const string PACKED_REFS_FILE = MINIGIT_DIR + "packed-refs";
+const string BRANCH_PREFIX = "refs/heads/";
+const string CONFIG_FILE = MINIGIT_DIR + "config";
+const string GRAPH_DIR = MINIGIT_DIR + "commit-graph/";
+const string MERGE_HEAD_FILE = MINIGIT_DIR + "MERGE_HEAD";
+//shorter ids would match too much of a large repository to be useful
+const size_t MIN_ABBREVIATED_ID = 4;
+//log output is written in pieces of about this size instead of per line
+const size_t LOG_FLUSH_SIZE = 64 << 10;
+
+//maxCount of a log without -n
+const uint64_t LOG_NO_LIMIT = UINT64_MAX;
+
+//what 'log' shows: at most maxCount commits (LOG_NO_LIMIT for all) made between
+//since and until (seconds, 0 for no bound) that changed path (a file or a
+//directory, "" for any), laid out by format ("" for the default layout)
+struct LogOptions {
+  uint64_t maxCount = LOG_NO_LIMIT;
+  uint64_t since = 0;
+  uint64_t until = 0;
+  string format;
+  string path;
+};
 
 
 class MiniGit{
@@ -19,8 +64,43 @@ class MiniGit{
     CommitList commits;
     string currentCommit;
     string currentBranch;
+    int64_t indexTimestamp = 0;//mtime of the index when it was last read
+    RepoConfig config;
+    int formatVersion = FORMAT_CURRENT;
+    ObjectStore objects{OBJECT_DIR};
+    CommitGraph graph{GRAPH_DIR};
+    PackedRefs packedRefs{PACKED_REFS_FILE};
+    //files of chunk.threshold MiB (64) and up are chunked, 0 turns it off;
+    //chunks average chunk.averageSize KiB (1024)
+    uint64_t chunkThreshold = 0;
+    Chunker chunker{1 << 20};
+    mutex chunkPoolLock;
+    unique_ptr<ThreadPool> chunkPool;//shared by every large file of a command
+
+    //repositories without a config file predate the format flag
+    void loadConfig(){
+      if (!fileExists(MINIGIT_DIR)) return;
+      if (config.load(CONFIG_FILE)) {
+        formatVersion = config.getInt("core.formatVersion", FORMAT_CURRENT);
+      } else {
+        formatVersion = FORMAT_LEGACY;
+      }
+      activeHashAlgorithm = formatVersion == FORMAT_LEGACY ? HASH_DJB2 : config.get("core.hash", HASH_BLAKE3);
+      objects.setCompressionLevel(config.getInt("core.compression", 1));
+      lockTimeoutMs = max(0L, config.getInt("core.lockTimeout", 10000));
+      chunkThreshold = uint64_t(max(0L, config.getInt("chunk.threshold", 64))) << 20;
+      chunker = Chunker(size_t(max(4L, config.getInt("chunk.averageSize", 1024))) << 10);
+      if (!parseDurability(config.get("core.durability", "batch"), durability)) {
+        cout <<"Warning: unknown core.durability '" <<config.get("core.durability", "") <<"', using batch\n";
+        durability = DURABILITY_BATCH;
+      }
+    }
 
   public:
+    MiniGit(){
+      loadConfig();
+    }
+
     bool initialize(){
       if (fileExists(MINIGIT_DIR)){
         cout <<"Minigit repository already exists.\n";
@@ -31,10 +111,19 @@ class MiniGit{
           createDirectory(OBJECT_DIR) && 
           createDirectory(REFS_DIR) &&
           createDirectory(HEAD_DIR) &&
-          writeFile(HEAD_DIR + "main", "\n") &&
-          writeFile(STAGING_AREA, "") &&
-          writeFile(HEAD_FILE, "ref: refs/heads/main\n")){
+          replaceFile(HEAD_DIR + "main", "\n") &&
+          replaceFile(STAGING_AREA, "") &&
+          replaceFile(HEAD_FILE, "ref: refs/heads/main\n")){
           
+          config.set("core.formatVersion", to_string(FORMAT_CURRENT));
+          config.set("core.hash", HASH_BLAKE3);
+          config.set("core.compression", "1");
+          if (!config.save(CONFIG_FILE)) {
+            cout <<"Error: failed to write " <<CONFIG_FILE <<"\n";
+            return false;
+          }
+          formatVersion = FORMAT_CURRENT;
+          activeHashAlgorithm = HASH_BLAKE3;
           currentCommit = "";
           currentBranch = "main";
           cout <<"Minigit has been successfully initialized in " <<MINIGIT_DIR <<"\n";
@@ -46,29 +135,150 @@ class MiniGit{
       
     //add files to the repository 
     bool addFiles(const string& filename){
+      return addFiles(vector<string>{filename});
+    }
+
+    //lists the files below root that 'add .' and status look at, .minigit excluded
+    vector<string> listWorkingFiles(const string& root = "."){
+      TraceScope scope("list working files");
+      vector<string> paths;
+      error_code ec;
+      filesystem::recursive_directory_iterator it(root, ec), end;
+      for (; !ec && it != end; it.increment(ec)) {
+        const auto& entry = *it;
+        if (entry.is_directory(ec) && entry.path().filename() == ".minigit") {
+          it.disable_recursion_pending();
+          continue;
+        }
+        // Ensure the entry exists and is a regular file before attempting to add
+        if (entry.exists(ec) && entry.is_regular_file(ec)) {
+          string filePath = normalizePath(entry.path().string());
+          // Skip the minigit executable in the top directory
+          if (filePath != "minigit" && filePath != "minigit.exe") {
+            paths.push_back(filePath);
+          }
+        }
+      }
+      if (ec) {
+        cout <<"Error listing files in current directory: " << ec.message() <<endl;
+      }
+      return paths;
+    }
+
+    //stages every file in the working directory and drops deleted ones
+    bool addAll(){
+      return addFiles(listWorkingFiles(), true);
+    }
+
+    //stages a list of files, reading and writing the index only once
+    //files whose stat data matches the index are not read or hashed again,
+    //the rest are hashed and stored on the worker pool
+    bool addFiles(const vector<string>& filenames, bool removeMissing = false){
       if (!fileExists(MINIGIT_DIR)) {
         cout <<"Error: initialize Minigit first\n" << "run ./minigit init\n";
         return false;
       }
-      if (!fileExists(filename)) {
-        cout <<"Error: Couldn't find " <<filename <<endl;
-        return false;
+      TraceScope scope("add");
+      auto start = chrono::steady_clock::now();
+
+      StagingIndex stagingArea;
+      if (!readStagingArea(stagingArea)) return false;
+      //directories stand for every file below them
+      vector<string> paths, requested;
+      for (const string& filename : filenames) {
+        if (filesystem::is_directory(filename)) {
+          for (const string& path : listWorkingFiles(filename)) {
+            paths.push_back(path);
+            requested.push_back(path);
+          }
+        } else {
+          paths.push_back(normalizePath(filename));
+          requested.push_back(filename);
+        }
       }
-      
-      string filecontent = readFile(filename);
-      string blobHash = generateHash(filecontent);
-      
-      createDirectory(OBJECT_DIR + blobHash + "/");
-      writeFile(OBJECT_DIR + blobHash + "/" + blobHash, filecontent);
-      
-      unordered_map<string, string> stagingArea = readStagingArea();
-      stagingArea[filename] = blobHash;
-      if (!writeStagingArea(stagingArea)){
-       cout <<"Error: Couldn't update staging area " <<filename <<endl;
-       return false;
+
+      vector<IndexEntry> entries(paths.size());
+      vector<char> found(paths.size(), 0);
+      vector<char> rehashed(paths.size(), 0);
+      vector<char> stored(paths.size(), 1);
+      atomic<uint64_t> totalBytes(0);
+      mutex writtenLock;
+      unordered_set<string> writtenBlobs;//blobs claimed by a worker in this run
+
+      ThreadPool pool;
+      parallelFor(pool, paths.size(), [&](size_t i){
+        FileStat st;
+        if (!statFile(paths[i], st)) return;
+        found[i] = 1;
+        entries[i].stat = st;
+        auto cached = stagingArea.find(paths[i]);
+        if (cached != stagingArea.end() && statMatches(cached->second, st, indexTimestamp)){
+          traceCount(TRACE_STAT_CACHE_HITS);
+          entries[i].blobHash = cached->second.blobHash;
+          return;
+        }
+
+        MappedFile file(paths[i]);//hashed and stored from the mapping, never copied to the heap
+        string blobHash = generateHash(file);
+        totalBytes += file.size();
+        entries[i].blobHash = blobHash;
+        rehashed[i] = 1;
+
+        {
+          lock_guard<mutex> guard(writtenLock);
+          if (!writtenBlobs.insert(blobHash).second) return;//identical content already handled
+        }
+        if (!storeBlob(blobHash, file)) stored[i] = 0;
+      });
+
+      size_t addedCount = 0, hashedCount = 0;
+      for (size_t i = 0; i < paths.size(); ++i){
+        if (!found[i]){
+          cout <<"Error: Couldn't find " <<requested[i] <<"\n";
+          continue;
+        }
+        if (!stored[i]){
+          cout <<"Error: Couldn't store " <<paths[i] <<"\n";
+          found[i] = 0;//left out of the index
+          continue;
+        }
+        addedCount++;
+        if (rehashed[i]){
+          hashedCount++;
+          cout <<"Successfully added " <<paths[i] <<" (blob: " <<entries[i].blobHash.substr(0, 7) <<")\n";
+        }
       }
-      cout <<"Successfully added " <<filename <<" (blob: " <<blobHash.substr(0, 7) <<")\n";
-      return true;
+      vector<string> removed;
+      if (removeMissing){
+        for (const auto& entry : stagingArea){
+          if (!fileExists(entry.first)) removed.push_back(entry.first);
+        }
+        sort(removed.begin(), removed.end());
+        for (const string& path : removed) cout <<"Removed " <<path <<"\n";
+      }
+      //the index is only locked to merge these results into its current
+      //content, so adds of other files running at the same time keep theirs
+      bool updated = (addedCount == 0 && removed.empty()) || updateStagingArea([&](StagingIndex& index){
+        for (size_t i = 0; i < paths.size(); ++i){
+          if (found[i]) index[paths[i]] = entries[i];
+        }
+        for (const string& path : removed) index.erase(path);
+      });
+      if (!updated){
+        cout <<"Error: Couldn't update staging area" <<endl;
+        return false;
+      }
+
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      double megabytes = totalBytes / (1024.0 * 1024.0);
+      if (seconds <= 0) seconds = 1e-9;
+      stringstream report;
+      report <<fixed <<"Added " <<addedCount <<" file(s), " <<addedCount - hashedCount <<" unchanged, "
+             <<setprecision(2) <<megabytes <<" MB hashed in "
+             <<setprecision(3) <<seconds <<"s (" <<setprecision(0) <<addedCount / seconds <<" files/s, "
+             <<setprecision(2) <<megabytes / seconds <<" MB/s, " <<pool.size() <<" threads)";
+      cout <<report.str() <<endl;
+      return addedCount == paths.size();
     }
     
     //to create snapshots of current file virsion
@@ -77,60 +287,295 @@ class MiniGit{
         cout <<"Error: initialize Minigit first\n" << "run ./minigit init\n";
         return false;
       }
-      unordered_map<string, string> stagingArea = readStagingArea();
-      if (stagingArea.empty()){
+      TraceScope scope("commit");
+      StagingIndex staged;
+      if (!readStagingArea(staged)) return false;
+      unordered_map<string, string> stagedBlobs = indexBlobs(staged);
+      string parentHash = getHeadHash();
+      string mergeHead = fileExists(MERGE_HEAD_FILE) ? readFile(MERGE_HEAD_FILE) : "";
+      if (!mergeHead.empty() && mergeHead.back() == '\n') mergeHead.pop_back();
+      //the index persists between commits, so compare it with HEAD's snapshot
+      if (stagedBlobs.empty() ||
+          (!parentHash.empty() && mergeHead.empty() && readCommit(parentHash).fileblobs == stagedBlobs)){
         cout <<"Notting to commit, working tree is clean.\n";
         return false;
       }
       
-      string parentHash = getHeadHash();
-      
       CommitNode newCommit(message, parentHash);
-      newCommit.fileblobs = stagingArea;
+      if (!mergeHead.empty()) newCommit.parents.push_back(mergeHead);
+      newCommit.fileblobs = stagedBlobs;
+      newCommit.treeHash = writeTree(objects, stagedBlobs);
+      if (newCommit.treeHash.empty()) {
+        cout << "Error: Could not write tree objects.\n";
+        return false;
+      }
+      return writeCommit(newCommit);
+    }
+
+    //stores a commit whose tree is written and moves HEAD to it
+    bool writeCommit(CommitNode& newCommit){
+      TraceScope scope("write commit");
       newCommit.computeAndSetHash();
 
-      if(!writeFile(OBJECT_DIR + newCommit.commitHash, commits.commitData(newCommit))){
+      if(!objects.write(newCommit.commitHash, OBJ_COMMIT, commits.commitData(newCommit))){
         cout << "Error: Could not write commit object.\n";
         return false;
       }
       
-      if(!updateHead(newCommit.commitHash)){
+      //the commit was built on its first parent, fail if the branch moved since
+      if(!updateHead(newCommit.commitHash, newCommit.parents.empty() ? "" : newCommit.parents[0])){
         cout <<"Error: couldn't update the head.\n";
         return false;
       }
       
-      if (!writeFile(STAGING_AREA, "")){
-        cout << "Warning: Couldn't clear staging area after commit.\n";
-      }
-      
+      removeFile(MERGE_HEAD_FILE);
+      updateCommitGraph(newCommit.commitHash);
       cout << "Committed: " << newCommit.commitHash.substr(0, 7) << " " << newCommit.message << std::endl;
       return true;
     }
     
-    //displays all commit from head backwards
-    void viewLog(){
+    //what is at path in a commit: the id of its blob or tree, for commits
+    //that list their files inline every file below path; "" when absent
+    bool pathState(const string& commitHash, const string& path, string& state){
+      state = "";
+      if (commitHash.empty()) return true;
+      string hash = commitHash;
+      CommitNode commit = readCommit(hash, false);
+      if (commit.commitHash.empty()) return false;
+      if (!commit.treeHash.empty()) return lookupTreePath(objects, commit.treeHash, path, state);
+      auto file = commit.fileblobs.find(path);
+      if (file != commit.fileblobs.end()) {
+          state = file->second;
+          return true;
+      }
+      map<string, string> below;
+      for (const auto& entry : commit.fileblobs) {
+          if (entry.first.compare(0, path.size() + 1, path + "/") == 0) below.insert(entry);
+      }
+      for (const auto& entry : below) state += entry.first + "=" + entry.second + "\n";
+      return true;
+    }
+
+    //whether a commit changed path from its first parent
+    bool changedPath(const string& commitHash, const string& parentHash, const string& path){
+      string now, before;
+      return !pathState(commitHash, path, now) || !pathState(parentHash, path, before) || now != before;
+    }
+
+    //one commit in the layout of a log format: %H and %h the full and short
+    //id, %P and %p the parents, %d the date, %s the message, %n a newline
+    void appendLogEntry(string& out, const string& format, const string& hash, const vector<string>& parents,
+                        const string& timestamp, const string& message){
+      if (format.empty()) {
+          out += "commitID: " + hash + "\n";
+          if (parents.size() > 1) {
+              out += "Merge:";
+              for (const string& parent : parents) out += " " + parent.substr(0, 7);
+              out += "\n";
+          }
+          out += "Date & time:   " + timestamp + "\n";
+          out += "\t" + message + "\n";
+          out += "---------------------------------------------\n";
+          return;
+      }
+      for (size_t i = 0; i < format.size(); ++i) {
+          if (format[i] != '%' || i + 1 == format.size()) {
+              out.push_back(format[i]);
+              continue;
+          }
+          char field = format[++i];
+          if (field == 'H') out += hash;
+          else if (field == 'h') out += hash.substr(0, 7);
+          else if (field == 'P' || field == 'p') {
+              for (size_t p = 0; p < parents.size(); ++p) {
+                  if (p) out += " ";
+                  out += field == 'P' ? parents[p] : parents[p].substr(0, 7);
+              }
+          }
+          else if (field == 'd') out += timestamp;
+          else if (field == 's') out += message;
+          else if (field == 'n') out += "\n";
+          else if (field == '%') out += "%";
+          else out += string("%") + field;
+      }
+      out += "\n";
+    }
+
+    //displays the commits from head backwards, newest first; a path is
+    //looked up in the commit-graph's path filters first, so only commits
+    //that may have changed it have their trees read
+    void viewLog(const LogOptions& options = LogOptions()){
       if (!fileExists(MINIGIT_DIR)) {
         cout <<"Error: initialize Minigit first\n" << "run ./minigit init\n";
         return;
       }
+      TraceScope scope("log");
       string currentHash = getHeadHash();
       if (currentHash.empty()){
         cout <<"There are no commits yet.\n";
         return;
       }
-      
-      while(!currentHash.empty()){
-        CommitNode commit = readCommit(currentHash);
-        cout << "commitID: " << commit.commitHash << endl;
-        cout << "Date & time:   " << commit.timestamp << endl;
-        cout << "\t" << commit.message << endl;
-        cout << "---------------------------------------------" <<endl;
-        currentHash = commit.parent;
+
+      string out;
+      uint64_t shown = 0;
+      auto show = [&](const string& hash, const vector<string>& parents, const string& timestamp, const string& message) {
+        appendLogEntry(out, options.format, hash, parents, timestamp, message);
+        shown++;
+        if (out.size() >= LOG_FLUSH_SIZE) {
+            cout << out;
+            out.clear();
+        }
+      };
+      auto done = [&]() { return shown >= options.maxCount; };
+      auto inRange = [&](uint64_t time) { return !options.until || time <= options.until; };
+
+      uint32_t position;
+      if (updateCommitGraph(currentHash) && graph.find(currentHash, position)) {
+        //the whole walk runs from the mapped graph, newest commit first and
+        //every side of a merge included
+        priority_queue<pair<uint64_t, uint32_t>> queue;//(time, position)
+        unordered_set<uint32_t> seen = {position};
+        queue.push({graph.commitTime(position), position});
+        vector<uint32_t> parents;
+        vector<string> parentHashes;
+        string timestamp, message;
+        while (!queue.empty() && !done()) {
+          uint64_t time = queue.top().first;
+          position = queue.top().second;
+          queue.pop();
+          //the queue is ordered by time, everything left is older
+          if (options.since && time < options.since) break;
+          graph.parents(position, parents);
+          for (uint32_t parent : parents) {
+            if (seen.insert(parent).second) queue.push({graph.commitTime(parent), parent});
+          }
+          if (!inRange(time)) continue;
+          if (!options.path.empty() && !graph.mayHaveChanged(position, options.path)) continue;
+          string hash = graph.hashAt(position);
+          parentHashes.clear();
+          for (uint32_t parent : parents) parentHashes.push_back(graph.hashAt(parent));
+          if (!options.path.empty() &&
+              !changedPath(hash, parentHashes.empty() ? "" : parentHashes[0], options.path)) continue;
+          graph.describe(position, timestamp, message);
+          show(hash, parentHashes, timestamp, message);
+        }
+        cout << out;
+        return;
+      }
+
+      string data;
+      CommitView commit;
+      vector<string> parentHashes;
+      while(!currentHash.empty() && !done() && readCommitView(currentHash, data, commit)){
+        parentHashes.clear();
+        for (size_t i = 0; i < commit.parentCount(); ++i) parentHashes.push_back(hexId(commit.parent(i)));
+        string firstParent = parentHashes.empty() ? "" : parentHashes[0];
+        string timestamp(commit.timestamp);
+        uint64_t time = parseCommitTime(timestamp);
+        if (options.since && time < options.since) break;
+        if (inRange(time) && (options.path.empty() || changedPath(currentHash, firstParent, options.path))) {
+          show(currentHash, parentHashes, timestamp, string(commit.message));
+        }
+        currentHash = firstParent;
+      }
+      cout << out;
+    }
+    
+    //shows staged, unstaged and untracked changes
+    //files whose stat data matches the index are not read at all
+    bool status(){
+      if (!fileExists(MINIGIT_DIR)) {
+        cout <<"Error: initialize Minigit first\n" << "run ./minigit init\n";
+        return false;
+      }
+      TraceScope scope("status");
+      StagingIndex index;
+      if (!readStagingArea(index)) return false;
+      string headHash = getHeadHash();
+      unordered_map<string, string> headBlobs;
+      if (!headHash.empty()) headBlobs = readCommit(headHash).fileblobs;
+
+      string headContent = readFile(HEAD_FILE);
+      if (headContent.rfind("ref: refs/heads/", 0) == 0) {
+        string branchName = headContent.substr(string("ref: refs/heads/").length());
+        if (!branchName.empty() && branchName.back() == '\n') branchName.pop_back();
+        cout <<"On branch " <<branchName <<"\n";
+      } else {
+        cout <<"HEAD detached at " <<headHash.substr(0, 7) <<"\n";
+      }
+
+      set<string> staged, unstaged, untracked;
+      for (const auto& entry : index) {
+        auto inHead = headBlobs.find(entry.first);
+        if (inHead == headBlobs.end()) staged.insert("new file:   " + entry.first);
+        else if (inHead->second != entry.second.blobHash) staged.insert("modified:   " + entry.first);
+      }
+      for (const auto& entry : headBlobs) {
+        if (!index.count(entry.first)) staged.insert("deleted:    " + entry.first);
+      }
+
+      //only files with stale stat data are rehashed, on the worker pool
+      vector<string> suspects;
+      vector<FileStat> suspectStats;
+      for (const auto& entry : index) {
+        FileStat st;
+        if (!statFile(entry.first, st)) {
+          unstaged.insert("deleted:    " + entry.first);
+        } else if (!statMatches(entry.second, st, indexTimestamp)) {
+          suspects.push_back(entry.first);
+          suspectStats.push_back(st);
+        } else {
+          traceCount(TRACE_STAT_CACHE_HITS);
+        }
+      }
+      vector<string> suspectHashes(suspects.size());
+      ThreadPool pool;
+      parallelFor(pool, suspects.size(), [&](size_t i){
+        suspectHashes[i] = generateFileHash(suspects[i]);
+      });
+      vector<size_t> refreshed;
+      for (size_t i = 0; i < suspects.size(); ++i) {
+        if (suspectHashes[i] == index[suspects[i]].blobHash) {
+          refreshed.push_back(i);//content unchanged, remember the new stat data
+        } else {
+          unstaged.insert("modified:   " + suspects[i]);
+        }
+      }
+      for (const string& path : listWorkingFiles()) {
+        if (!index.count(path)) untracked.insert(path);
+      }
+      if (!refreshed.empty()) {
+        updateStagingArea([&](StagingIndex& current){
+          for (size_t i : refreshed) {
+            auto entry = current.find(suspects[i]);
+            if (entry != current.end() && entry->second.blobHash == suspectHashes[i]) entry->second.stat = suspectStats[i];
+          }
+        });
+      }
+
+      if (!staged.empty()) {
+        cout <<"Changes to be committed:\n";
+        for (const string& line : staged) cout <<"\t" <<line <<"\n";
+      }
+      if (!unstaged.empty()) {
+        cout <<"Changes not staged for commit:\n";
+        for (const string& line : unstaged) cout <<"\t" <<line <<"\n";
+      }
+      if (!untracked.empty()) {
+        cout <<"Untracked files:\n";
+        for (const string& line : untracked) cout <<"\t" <<line <<"\n";
       }
+      if (staged.empty() && unstaged.empty() && untracked.empty()) {
+        cout <<"Nothing to commit, working tree is clean.\n";
+      }
+      cout.flush();
+      return true;
     }
     
-    // Displays all local branches
-    void showBranches() {
+    //lists the local branches whose name starts with prefix; loose and packed
+    //refs are merged in name order, the loose names come from the directory
+    //listing and the packed ones from the mapped file, so no ref is opened
+    void showBranches(const string& prefix = "") {
       if (!fileExists(MINIGIT_DIR)) {
         cout << "Error: initialize Minigit first\n" << "run ./minigit init\n";
         return;
@@ -154,18 +599,39 @@ class MiniGit{
           return;
       }
 
-      cout << "Branches:\n";
-      // Iterate through the files (branches) in the HEAD_DIR
+      vector<string> loose;
       for (const auto& entry : filesystem::directory_iterator(HEAD_DIR, ec)) {
-          if (entry.is_regular_file(ec)) { // Ensure it's a file and not a subdirectory
-              string branchName = entry.path().filename().string();
-              string branchPrefix = (branchName == currentBranchName) ? "\t*" : "\t"; // Mark current branch
-              cout << branchPrefix << branchName << endl;
+          string branchName = entry.path().filename().string();
+          if (branchName.compare(0, prefix.size(), prefix) == 0 && !isTempFile(branchName) && entry.is_regular_file(ec)) {
+              loose.push_back(branchName);
           }
       }
       if (ec) { // Check for errors during directory iteration
           cout << "Error listing branches: " << ec.message() << endl;
       }
+      sort(loose.begin(), loose.end());
+
+      //output is collected in large pieces instead of being flushed per line
+      string out = "Branches:\n";
+      auto emit = [&](const string_view& branchName) {
+          out += branchName == currentBranchName ? "\t*" : "\t"; // Mark current branch
+          out.append(branchName.data(), branchName.size());
+          out += '\n';
+          if (out.size() >= IO_BUFFER_SIZE) {
+              cout << out;
+              out.clear();
+          }
+      };
+      size_t next = 0;
+      packedRefs.forEach(BRANCH_PREFIX + prefix, [&](const string_view& name, const string_view&) {
+          string_view branchName = name.substr(BRANCH_PREFIX.size());
+          while (next < loose.size() && string_view(loose[next]) < branchName) emit(loose[next++]);
+          if (next < loose.size() && string_view(loose[next]) == branchName) next++;//listed once, as the loose ref
+          emit(branchName);
+      });
+      while (next < loose.size()) emit(loose[next++]);
+      cout << out;
+      cout.flush();
     }
     
     bool branching(const string& name) {
@@ -180,13 +646,14 @@ class MiniGit{
             return false;
         }
 
-        string branchPath = HEAD_DIR + name;
-        if (fileExists(branchPath)) {
+        string existing;
+        if (readRef(BRANCH_PREFIX + name, existing)) {
             cout << "Error: Branch '" << name << "' already exists.\n";
             return false;
         }
 
-        if (writeFile(branchPath, currentHash + "\n")) {
+        string missing;
+        if (updateRef(BRANCH_PREFIX + name, currentHash, &missing)) {
             cout << "Created branch '" << name << "' pointing to " << currentHash << endl;
             return true;
         }
@@ -194,28 +661,73 @@ class MiniGit{
         return false;
     }
 
-    unordered_map<string, string> readStagingArea() {
-      unordered_map <string, string> sa;
-      string content = readFile(STAGING_AREA);
-      stringstream ss(content);
-      string line;
-      while (getline(ss, line)) {
-          size_t spacePos = line.find(' ');
-          if (spacePos != string::npos) {
-              string filePath = line.substr(0, spacePos);
-              string blobHash = line.substr(spacePos + 1);
-              sa[filePath] = blobHash;
-          }
+    //false when the index is damaged or of an unknown version; callers
+    //must not go on, an empty index would read as every file deleted
+    bool readStagingArea(StagingIndex& sa) {
+      TraceScope scope("read index");
+      FileStat indexStat;
+      indexTimestamp = statFile(STAGING_AREA, indexStat) ? indexStat.mtimeNs : 0;
+      return decodeIndex(readFile(STAGING_AREA), sa);
+    }
+    
+    //replaces the whole index, under its lock
+    bool writeStagingArea(const StagingIndex& stagingArea) {
+      TraceScope scope("write index");
+      LockFile lock;
+      return lock.acquire(STAGING_AREA) && lock.commit(encodeIndex(stagingArea));
+    }
+
+    //re-reads the index under its lock, applies change and writes it back,
+    //so entries other processes staged in the meantime are kept
+    bool updateStagingArea(const function<void(StagingIndex&)>& change) {
+      TraceScope scope("update index");
+      LockFile lock;
+      StagingIndex index;
+      if (!lock.acquire(STAGING_AREA) || !readStagingArea(index)) return false;
+      change(index);
+      return lock.commit(encodeIndex(index));
+    }
+
+    //value of a ref such as "HEAD" or "refs/heads/main", false if there is
+    //no such ref; a loose file under .minigit/ wins over packed-refs
+    bool readRef(const string& refname, string& value) {
+      string path = MINIGIT_DIR + refname;
+      if (fileExists(path)) {
+        value = readFile(path);
+        if (!value.empty() && value.back() == '\n') value.pop_back();
+        return true;
+      }
+      return refname != "HEAD" && packedRefs.find(refname, value);
+    }
+
+    //moves a ref (or HEAD) to value under its lock; with expected the update
+    //only happens while the ref still holds that value ("" = doesn't exist)
+    //the new value is always written as a loose ref
+    bool updateRef(const string& refname, const string& value, const string* expected = nullptr) {
+      LockFile lock;
+      if (!lock.acquire(MINIGIT_DIR + refname)) return false;
+      if (expected) {
+        string current;
+        readRef(refname, current);
+        if (current != *expected) {
+          cout <<"Error: " <<refname <<" changed to '" <<current.substr(0, 7) <<"' while this command ran, expected '"
+               <<expected->substr(0, 7) <<"'\n";
+          return false;
         }
-      return sa;
+      }
+      return lock.commit(value + "\n");
     }
     
-    bool writeStagingArea(const unordered_map<string, string>& stagingArea) {
-      stringstream ss;
-      for (const auto& entry : stagingArea) {
-          ss << entry.first << " " << entry.second << "\n";
+    //records the current stat data of each written file in the index
+    StagingIndex indexFromBlobs(const unordered_map<string, string>& blobs){
+      StagingIndex index;
+      for (const auto& entry : blobs){
+        IndexEntry indexEntry;
+        indexEntry.blobHash = entry.second;
+        statFile(entry.first, indexEntry.stat);
+        index[entry.first] = indexEntry;
       }
-      return writeFile(STAGING_AREA, ss.str());
+      return index;
     }
     
     
@@ -231,36 +743,533 @@ class MiniGit{
         if (!refPath.empty() && refPath.back() == '\n') {
             refPath.pop_back();
         }
-        string branchRef = MINIGIT_DIR + refPath;
-        string targethash = readFile(branchRef);
-        if (!targethash.empty() && targethash.back() == '\n') {
-            targethash.pop_back();
-        }
+        string targethash;
+        readRef(refPath, targethash);
         return targethash;
       }
+      //detached HEAD stores the commit hash directly
+      if (headContent.back() == '\n') {
+          headContent.pop_back();
+      }
       return headContent;
     }
     
-    CommitNode readCommit(string& currentHash){
-      string commitPath = OBJECT_DIR + currentHash;
-      string data = readFile(commitPath);
-      if (data.empty()) {
+    //withFiles = false skips expanding the commit's tree into fileblobs
+    //the stored bytes of a commit, false if there is none
+    bool readCommitData(const string& hash, string& data){
+      if (!objects.read(hash, data)) {
+        //commits written before the object store were kept as objects/<hash>
+        string legacyPath = OBJECT_DIR + hash;
+        if (hash.empty() || !filesystem::is_regular_file(legacyPath)) return false;
+        data = readFile(legacyPath);
+      }
+      return !data.empty();
+    }
+
+    //the header of a commit as a view into data, nothing else is decoded
+    bool readCommitView(const string& hash, string& data, CommitView& view){
+      TraceScope scope("read commit header");
+      return readCommitData(hash, data) && commits.headerView(data, hash, view);
+    }
+
+    CommitNode readCommit(string& currentHash, bool withFiles = true){
+      TraceScope scope("read commit");
+      string data;
+      if (!readCommitData(currentHash, data)) {
         return CommitNode();
+      }
+      CommitNode commit = commits.deserialize(data, currentHash);
+      if (withFiles && !commit.treeHash.empty()) {
+        TraceScope flatten("flatten tree");
+        if (!flattenTree(objects, commit.treeHash, "", commit.fileblobs)) {
+          cout << "Error: tree " << commit.treeHash << " of commit " << currentHash << " is damaged.\n";
+          return CommitNode();//a partial snapshot would read as deleted files
+        }
+      }
+      return commit;
+    }
+  
+  bool usesLegacyFormat() const {
+    return formatVersion == FORMAT_LEGACY;
+  }
+
+  //rewrites a format version 1 (djb2) repository to blake3 ids: every blob
+  //and commit reachable from a branch, HEAD or the index gets a new id,
+  //then refs, index and config are switched and the old objects removed
+  bool migrate() {
+    if (!fileExists(MINIGIT_DIR)) {
+        cout <<"Error: initialize Minigit first\n" << "run ./minigit init\n";
+        return false;
+    }
+    TraceScope scope("migrate");
+    if (formatVersion != FORMAT_LEGACY) {
+        cout << "Repository already uses format version " << formatVersion << " (" << activeHashAlgorithm << ").\n";
+        return true;
+    }
+
+    map<string, string> branchTips = readBranchTips();
+    error_code ec;
+    string headContent = readFile(HEAD_FILE);
+    bool detached = headContent.rfind("ref: ", 0) != 0;
+    string detachedHash = detached ? getHeadHash() : "";
+
+    //collect commits so that parents come before their children
+    vector<string> order;
+    unordered_map<string, CommitNode> oldCommits;
+    vector<pair<string, bool>> stack;
+    for (const auto& tip : branchTips) if (!tip.second.empty()) stack.push_back({tip.second, false});
+    if (!detachedHash.empty()) stack.push_back({detachedHash, false});
+    while (!stack.empty()) {
+        pair<string, bool> top = stack.back();
+        stack.pop_back();
+        if (top.second) {
+            order.push_back(top.first);
+            continue;
+        }
+        if (oldCommits.count(top.first)) continue;
+        string hash = top.first;
+        CommitNode c = readCommit(hash);
+        if (c.commitHash.empty()) {
+            cout << "Error: commit " << hash << " is missing, migration aborted.\n";
+            return false;
+        }
+        oldCommits[hash] = c;
+        stack.push_back({hash, true});
+        for (const string& parent : c.parents) {
+            if (!oldCommits.count(parent)) stack.push_back({parent, false});
+        }
+    }
+
+    unordered_map<string, string> blobMap;
+    auto migrateBlob = [&](const string& oldHash) -> string {
+        auto known = blobMap.find(oldHash);
+        if (known != blobMap.end()) return known->second;
+        string content;
+        if (!objects.read(oldHash, content)) {
+            cout << "Warning: blob " << oldHash << " is missing, keeping its old id.\n";
+            return blobMap[oldHash] = oldHash;
+        }
+        string newHash = hashWith(HASH_BLAKE3, content.data(), content.size());
+        objects.write(newHash, OBJ_BLOB, content);
+        return blobMap[oldHash] = newHash;
+    };
+
+    activeHashAlgorithm = HASH_BLAKE3;
+    unordered_map<string, string> commitMap;
+    unordered_set<string> treeIds;
+    for (const string& oldHash : order) {
+        CommitNode rewritten = oldCommits[oldHash];
+        for (string& parent : rewritten.parents) parent = commitMap[parent];
+        for (auto& entry : rewritten.fileblobs) entry.second = migrateBlob(entry.second);
+        if (!rewritten.treeHash.empty()) {
+            rewritten.treeHash = writeTree(objects, rewritten.fileblobs, &treeIds);
+            if (rewritten.treeHash.empty()) {
+                activeHashAlgorithm = HASH_DJB2;
+                cout << "Error: Could not write tree object, migration aborted.\n";
+                return false;
+            }
+        }
+        rewritten.computeAndSetHash();
+        if (!objects.write(rewritten.commitHash, OBJ_COMMIT, commits.commitData(rewritten))) {
+            activeHashAlgorithm = HASH_DJB2;
+            cout << "Error: Could not write commit object, migration aborted.\n";
+            return false;
+        }
+        commitMap[oldHash] = rewritten.commitHash;
+    }
+
+    StagingIndex index;
+    if (!readStagingArea(index)) {
+        activeHashAlgorithm = HASH_DJB2;
+        cout << "Error: Could not read the staging area, migration aborted.\n";
+        return false;
+    }
+    for (auto& entry : index) entry.second.blobHash = migrateBlob(entry.second.blobHash);
+
+    //new objects are all in place, switch the refs, index and format flag
+    for (const auto& tip : branchTips) {
+        if (!tip.second.empty()) updateRef(BRANCH_PREFIX + tip.first, commitMap[tip.second]);
+    }
+    if (!detachedHash.empty()) updateRef("HEAD", commitMap[detachedHash]);
+    writeStagingArea(index);
+    config.set("core.formatVersion", to_string(FORMAT_CURRENT));
+    config.set("core.hash", HASH_BLAKE3);
+    if (!config.save(CONFIG_FILE)) {
+        cout << "Error: failed to write " << CONFIG_FILE << "\n";
+        return false;
+    }
+    formatVersion = FORMAT_CURRENT;
+
+    //anything else in the store is an old id or was unreachable
+    unordered_set<string> keep;
+    for (const auto& entry : blobMap) keep.insert(entry.second);
+    for (const auto& entry : commitMap) keep.insert(entry.second);
+    keep.insert(treeIds.begin(), treeIds.end());
+    vector<filesystem::path> stale;
+    for (const auto& entry : filesystem::directory_iterator(OBJECT_DIR, ec)) {
+        if (!keep.count(entry.path().filename().string())) stale.push_back(entry.path());
+    }
+    for (const auto& path : stale) filesystem::remove_all(path, ec);
+    graph.clear();//every commit id changed
+    objects.packSet().reload();
+
+    cout << "Migrated " << commitMap.size() << " commit(s) and " << blobMap.size()
+         << " blob(s) to format version " << FORMAT_CURRENT << " (" << HASH_BLAKE3 << ").\n";
+    return true;
+  }
+  
+  //the commit-graph path filter of a commit, from the files it changed
+  //from its first parent; "" (unknown) if they can't be read
+  string changedPathFilter(string hash, const CommitView& commit) {
+    string parentHash = commit.parentCount() ? hexId(commit.parent(0)) : "";
+    string parentData;
+    CommitView parent;
+    if (!parentHash.empty() && !readCommitView(parentHash, parentData, parent)) return "";
+    vector<string> files;
+    if (!commit.tree.empty() && (parentHash.empty() || !parent.tree.empty())) {
+        //unchanged directories are skipped without being read
+        vector<TreeChange> changes;
+        if (!diffTrees(objects, parent.tree.empty() ? "" : hexId(parent.tree), hexId(commit.tree), "", changes)) return "";
+        for (const TreeChange& change : changes) files.push_back(change.path);
+        return buildPathFilter(files);
+    }
+    //at least one side lists its files inline
+    unordered_map<string, string> now = readCommit(hash).fileblobs, before;
+    if (!parentHash.empty()) before = readCommit(parentHash).fileblobs;
+    for (const auto& file : now) {
+        auto old = before.find(file.first);
+        if (old == before.end() || old->second != file.second) files.push_back(file.first);
+    }
+    for (const auto& file : before) {
+        if (!now.count(file.first)) files.push_back(file.first);
+    }
+    return buildPathFilter(files);
+  }
+
+  //adds tip and any of its ancestors missing from the commit-graph, false
+  //when part of the history can't be read
+  bool updateCommitGraph(const string& tip) {
+    uint32_t position;
+    if (tip.empty() || graph.find(tip, position)) return !tip.empty();
+    TraceScope scope("update commit graph");
+    vector<GraphCommit> missing;
+    unordered_set<string> seen;
+    vector<pair<string, bool>> stack = {{tip, false}};
+    unordered_map<string, GraphCommit> loaded;
+    while (!stack.empty()) {
+        pair<string, bool> top = stack.back();
+        stack.pop_back();
+        if (top.second) {
+            missing.push_back(move(loaded[top.first]));
+            continue;
+        }
+        if (!seen.insert(top.first).second || graph.find(top.first, position)) continue;
+        const string& hash = top.first;
+        string data;
+        CommitView commit;
+        if (!readCommitView(hash, data, commit)) return false;
+        GraphCommit& entry = loaded[hash];
+        entry.hash = hash;
+        entry.timestamp = string(commit.timestamp);
+        entry.message = string(commit.message);
+        for (size_t i = 0; i < commit.parentCount(); ++i) entry.parents.push_back(hexId(commit.parent(i)));
+        entry.pathFilter = changedPathFilter(hash, commit);
+        stack.push_back({hash, true});
+        for (const string& parent : entry.parents) stack.push_back({parent, false});
     }
-    return commits.deserialize(data);
+    return graph.append(missing);
+  }
+
+  //moves every loose branch into packed-refs; a loose ref is deleted only
+  //if it still holds the packed value once its own lock is held, so a
+  //branch moved meanwhile keeps its newer loose value
+  bool packRefs() {
+    TraceScope scope("pack refs");
+    LockFile packedLock;
+    if (!packedLock.acquire(PACKED_REFS_FILE)) return false;
+    map<string, string> refs;
+    packedRefs.forEach("", [&](const string_view& name, const string_view& hash) {
+        refs[string(name)] = string(hash);
+    });
+    vector<pair<string, string>> loose;
+    error_code ec;
+    for (const auto& entry : filesystem::directory_iterator(HEAD_DIR, ec)) {
+        string name = entry.path().filename().string();
+        if (!entry.is_regular_file(ec) || isTempFile(name)) continue;
+        string tip;
+        readRef(BRANCH_PREFIX + name, tip);
+        if (tip.empty()) continue;//a branch without commits stays loose
+        refs[BRANCH_PREFIX + name] = tip;
+        loose.push_back({BRANCH_PREFIX + name, tip});
+    }
+    if (loose.empty()) return true;
+    if (!packedLock.commit(encodePackedRefs(refs))) {
+        cout << "Error: could not write " << PACKED_REFS_FILE << "\n";
+        return false;
+    }
+    packedRefs.reload();
+    size_t packed = 0;
+    for (const auto& ref : loose) {
+        LockFile lock;
+        string current;
+        if (!lock.acquire(MINIGIT_DIR + ref.first) || !readRef(ref.first, current) || current != ref.second) continue;
+        if (removeFile(MINIGIT_DIR + ref.first)) packed++;
+    }
+    cout << "Packed " << packed << " ref(s) into " << PACKED_REFS_FILE << "\n";
+    return true;
+  }
+
+  //branch name -> tip commit for every branch, packed or loose
+  map<string, string> readBranchTips() {
+    map<string, string> branchTips;
+    packedRefs.forEach(BRANCH_PREFIX, [&](const string_view& name, const string_view& hash) {
+        branchTips[string(name.substr(BRANCH_PREFIX.size()))] = string(hash);
+    });
+    error_code ec;
+    for (const auto& entry : filesystem::directory_iterator(HEAD_DIR, ec)) {
+        if (!entry.is_regular_file(ec) || isTempFile(entry.path().filename().string())) continue;
+        string tip = readFile(entry.path().string());
+        if (!tip.empty() && tip.back() == '\n') tip.pop_back();
+        branchTips[entry.path().filename().string()] = tip;
+    }
+    return branchTips;
+  }
+
+  //blob -> (path, recency) for every blob in the index or in a commit
+  //reachable from HEAD or a branch, recency 0 being the newest
+  unordered_map<string, pair<string, size_t>> blobPaths() {
+    unordered_map<string, pair<string, size_t>> paths;
+    StagingIndex index;
+    readStagingArea(index);//only a hint for delta bases, history gives the rest
+    for (const auto& entry : index) paths.insert({entry.second.blobHash, {entry.first, 0}});
+    deque<string> queue;
+    queue.push_back(getHeadHash());
+    for (const auto& tip : readBranchTips()) queue.push_back(tip.second);
+    unordered_set<string> visited;
+    size_t rank = 0;
+    while (!queue.empty()) {
+        string hash = queue.front();
+        queue.pop_front();
+        if (hash.empty() || !visited.insert(hash).second) continue;
+        CommitNode c = readCommit(hash);
+        if (c.commitHash.empty()) continue;
+        rank++;
+        for (const auto& blob : c.fileblobs) paths.insert({blob.second, {blob.first, rank}});
+        for (const string& parent : c.parents) queue.push_back(parent);
+    }
+    return paths;
+  }
+
+  //consolidates every loose object and existing pack into a single new pack,
+  //then removes what was packed
+  //blobs are grouped by path, newest first, and each is stored as a delta
+  //against one of the previous pack.window blobs when that is much smaller;
+  //the newest version of a file stays whole so recent checkouts don't
+  //rebuild anything and chains never get deeper than pack.depth
+  bool gc() {
+    if (!fileExists(MINIGIT_DIR)) {
+        cout <<"Error: initialize Minigit first\n" << "run ./minigit init\n";
+        return false;
+    }
+    TraceScope scope("gc");
+    if (!packRefs()) return false;
+    //a graph written before path filters existed is rebuilt with them
+    if (!graph.hasPathFilters()) {
+        graph.clear();
+        for (const auto& tip : readBranchTips()) updateCommitGraph(tip.second);
+        updateCommitGraph(getHeadHash());
+    }
+    auto start = chrono::steady_clock::now();
+    PackSet& packs = objects.packSet();
+    vector<pair<string, string>> loose = objects.looseObjects();
+    vector<string> oldPacks;
+    for (const auto& pack : packs.all()) oldPacks.push_back(pack->name);
+    if (loose.empty() && oldPacks.size() <= 1) {
+        cout << "Nothing to pack.\n";
+        return true;
+    }
+    int depthLimit = max(0, min<int>(config.getInt("pack.depth", 10), PACK_MAX_CHAIN - 1));
+    size_t window = max<long>(0, config.getInt("pack.window", 10));
+
+    //every object once, loose copies win over packed ones
+    unordered_map<string, string> loosePaths(loose.begin(), loose.end());
+    vector<string> hashes;
+    for (const auto& object : loose) hashes.push_back(object.first);
+    for (const auto& pack : packs.all()) {
+        for (uint32_t i = 0; i < pack->objectCount(); ++i) {
+            string hash = pack->hashAt(i);
+            if (!loosePaths.count(hash)) hashes.push_back(hash);
+        }
+    }
+    sort(hashes.begin(), hashes.end());
+    hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+
+    struct DeltaCandidate {
+        string hash;
+        string path;
+        size_t rank;
+        uint64_t size;
+    };
+    unordered_map<string, pair<string, size_t>> paths = blobPaths();
+    vector<ObjectInfo> infos(hashes.size());
+    vector<char> known(hashes.size(), 0);
+    //chunk lists are copied as they are; their chunks are already shared
+    //wherever content repeats and are kept whole too
+    unordered_set<string> chunkIds;
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        known[i] = objects.info(hashes[i], infos[i]);
+        vector<ChunkRef> chunks;
+        if (known[i] && infos[i].chunked && objects.chunkList(hashes[i], chunks)) {
+            for (const ChunkRef& chunk : chunks) chunkIds.insert(chunk.hash);
+        }
+    }
+    vector<DeltaCandidate> candidates;
+    vector<string> wholeObjects;
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        const string& hash = hashes[i];
+        const ObjectInfo& info = infos[i];
+        if (known[i] && info.type == OBJ_BLOB && !info.chunked && !chunkIds.count(hash) &&
+            info.size >= DELTA_BLOCK && info.size <= PACK_DELTA_MAX_SIZE) {
+            auto it = paths.find(hash);
+            if (it != paths.end()) candidates.push_back({hash, it->second.first, it->second.second, info.size});
+            else candidates.push_back({hash, "", 0, info.size});
+        } else {
+            wholeObjects.push_back(hash);
+        }
+    }
+    //blobs without a known path are only compared by size
+    sort(candidates.begin(), candidates.end(), [](const DeltaCandidate& a, const DeltaCandidate& b) {
+        if (a.path != b.path) return a.path < b.path;
+        if (a.rank != b.rank) return a.rank < b.rank;
+        return a.size > b.size;
+    });
+
+    PackWriter writer;
+    if (!writer.begin(objects.packDirectory())) return false;
+    auto fail = [&](const string& hash) {
+        cout << "Error: could not pack object " << hash << endl;
+        writer.abandon();
+        return false;
+    };
+
+    //objects kept whole are copied in their stored encoding
+    uint64_t looseBytes = 0;
+    for (const string& hash : wholeObjects) {
+        auto looseIt = loosePaths.find(hash);
+        const char* data;
+        size_t size;
+        uint8_t kind;
+        bool ok;
+        if (looseIt != loosePaths.end()) {
+            MappedFile file(looseIt->second);
+            ok = file.ok() && writer.add(hash, PACK_FULL, file.data(), file.size());
+            looseBytes += file.size();
+        } else if (packs.find(hash, data, size, kind) && kind == PACK_FULL) {
+            ok = writer.add(hash, PACK_FULL, data, size);
+        } else {
+            string content, encoded;
+            ObjectInfo info;
+            ok = objects.read(hash, content, &info);
+            objects.encode(info.type, content.data(), content.size(), encoded);
+            ok = ok && writer.add(hash, PACK_FULL, encoded.data(), encoded.size());
+        }
+        if (!ok) return fail(hash);
+    }
+
+    struct WindowEntry {
+        string hash;
+        shared_ptr<const string> content;
+        int depth;
+    };
+    deque<WindowEntry> recent;//newest first
+    size_t deltaCount = 0;
+    string previousPath;
+    for (const DeltaCandidate& candidate : candidates) {
+        shared_ptr<string> content = make_shared<string>();
+        if (!objects.read(candidate.hash, *content)) return fail(candidate.hash);
+        auto looseIt = loosePaths.find(candidate.hash);
+        if (looseIt != loosePaths.end()) looseBytes += filesystem::file_size(looseIt->second);
+        if (candidate.path != previousPath) recent.clear();
+        previousPath = candidate.path;
+
+        //a delta has to at least halve the object to be worth the rebuild
+        string best, delta;
+        const WindowEntry* base = nullptr;
+        for (const WindowEntry& entry : recent) {
+            if (entry.depth >= depthLimit) continue;
+            size_t limit = best.empty() ? content->size() / 2 : best.size() - 1;
+            delta.clear();
+            if (createDelta(entry.content->data(), entry.content->size(), content->data(), content->size(), limit, delta)) {
+                best.swap(delta);
+                base = &entry;
+            }
+        }
+        int depth = 0;
+        bool ok;
+        if (base) {
+            ok = writer.add(candidate.hash, PACK_DELTA, best.data(), best.size(),
+                            encodeDeltaHeader(hexToBytes(base->hash), OBJ_BLOB, content->size()));
+            depth = base->depth + 1;
+            deltaCount++;
+        } else {
+            string encoded;
+            objects.encode(OBJ_BLOB, content->data(), content->size(), encoded);
+            ok = writer.add(candidate.hash, PACK_FULL, encoded.data(), encoded.size());
+        }
+        if (!ok) return fail(candidate.hash);
+        recent.push_front({candidate.hash, content, depth});
+        if (recent.size() > window) recent.pop_back();
+    }
+
+    string packName;
+    if (!writer.finish(packName)) {
+        writer.abandon();
+        return false;
+    }
+
+    //the new pack holds everything, drop the old packs and loose copies
+    //once it is safely on disk
+    if (!flushSyncs()) {
+        cout << "Error: could not sync the new pack, keeping the old objects.\n";
+        return false;
+    }
+    error_code ec;
+    for (const string& name : oldPacks) {
+        if (name == packName) continue;
+        filesystem::remove(objects.packDirectory() + name + ".idx", ec);
+        filesystem::remove(objects.packDirectory() + name + ".pack", ec);
+    }
+    packs.reload();
+    size_t removed = 0;
+    for (const auto& object : loose) {
+        if (!objects.has(object.first)) continue;//should not happen, keep the loose copy
+        filesystem::path objectPath(object.second);
+        if (objectPath.parent_path().filename() == object.first) filesystem::remove_all(objectPath.parent_path(), ec);
+        else filesystem::remove(objectPath, ec);
+        removed++;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t packBytes = filesystem::file_size(objects.packDirectory() + packName + ".pack", ec);
+    stringstream report;
+    report << fixed << setprecision(2) << "Packed " << hashes.size() << " object(s), " << deltaCount << " as deltas, into "
+           << packName << " (" << removed << " loose, " << looseBytes / (1024.0 * 1024.0) << " MB -> "
+           << packBytes / (1024.0 * 1024.0) << " MB pack) in " << setprecision(3) << seconds << "s";
+    cout << report.str() << endl;
+    return true;
   }
   
-  bool updateHead(const string& commitHash) {
+  //moves the current branch (or a detached HEAD) from expected to commitHash
+  bool updateHead(const string& commitHash, const string& expected) {
     string headContent = readFile(HEAD_FILE);
     if (headContent.rfind("ref: ", 0) == 0) {
         string refPath = headContent.substr(5);
         if (!refPath.empty() && refPath.back() == '\n') {
             refPath.pop_back();
         }
-        string branchRef = MINIGIT_DIR + refPath;
-        return writeFile(branchRef, commitHash + "\n");
+        return updateRef(refPath, commitHash, &expected);
     } else {
-        return writeFile(HEAD_FILE, commitHash + "\n");
+        return updateRef("HEAD", commitHash, &expected);
     }
   }
   
@@ -269,108 +1278,278 @@ class MiniGit{
         cout <<"Error: initialize Minigit first\n" << "run ./minigit init\n";
         return false;
     }
+    TraceScope scope("checkout");
 
-    string targetCommitHash;
-    string branchPath = HEAD_DIR + target;
+    string targetCommitHash, headValue;
+    string previousHash = getHeadHash();
 
-    if (fileExists(branchPath)) {
-        targetCommitHash = readFile(branchPath);
-        if (!targetCommitHash.empty() && targetCommitHash.back() == '\n') {
-            targetCommitHash.pop_back();
-        }
+    if (readRef(BRANCH_PREFIX + target, targetCommitHash)) {
         if (targetCommitHash.empty()) {
              cout << "Error: Branch '" << target << "' has no commits yet. Cannot switch to it.\n";
              return false;
         }
-
-        if (!writeFile(HEAD_FILE, "ref: refs/heads/" + target + "\n")) {
-            cout << "Error: Could not update HEAD to branch " << target << endl;
-            return false;
-        }
+        headValue = "ref: refs/heads/" + target;
     } else {
-        // Corrected path for checking if target is a commit hash
-        if (!fileExists(OBJECT_DIR + target + "/" + target)) {
+        //a commit id, possibly abbreviated
+        if (!resolveObjectId(target, OBJ_COMMIT, targetCommitHash)) return false;
+        ObjectType type = objects.typeOf(targetCommitHash);
+        if (type == 0) {
             cout << "Error: Neither branch '" << target << "' nor commit '" << target << "' found.\n";
             return false;
         }
-        targetCommitHash = target;
-        if (!writeFile(HEAD_FILE, targetCommitHash + "\n")) {
-            cout << "Error: Could not update HEAD to commit " << target <<endl;
+        if (type != OBJ_COMMIT) {
+            cout << "Error: '" << target << "' is a " << objectTypeName(type) << ", not a commit.\n";
             return false;
         }
+        headValue = targetCommitHash;
     }
 
-    CommitNode targetCommit = readCommit(targetCommitHash);
-
-    error_code ec;
-    for (const auto& entry : filesystem::directory_iterator(".", ec)) {
-        std::string currentPath = entry.path().string();
-        if (currentPath == MINIGIT_DIR || filesystem::path(currentPath).filename() == "minigit" || filesystem::path(currentPath).filename() == "minigit.exe") continue;
-
-        if (entry.is_directory(ec)) continue;
-
-        string canonicalPath = filesystem::relative(entry.path(), filesystem::current_path()).string();
+    //the target is read before HEAD moves or any file is touched
+    CommitNode targetCommit = readCommit(targetCommitHash, false);
+    if (targetCommit.commitHash.empty()) {
+        cout << "Error: commit " << targetCommitHash << " can't be read.\n";
+        return false;
+    }
 
-        if (fileExists(canonicalPath) &&
-            targetCommit.fileblobs.find(canonicalPath) == targetCommit.fileblobs.end()) {
-            removeFile(canonicalPath);
+    //only paths whose blob differs between the two snapshots are touched,
+    //everything else keeps its file and its index entry
+    string previousCopy = previousHash;
+    CommitNode previousCommit = previousHash.empty() ? CommitNode() : readCommit(previousCopy, false);
+    StagingIndex index;
+    if (!readStagingArea(index)) return false;
+    vector<TreeChange> changes;
+    TraceScope diffing("diff snapshots");
+    //identical subtrees are skipped without reading them
+    bool fromTrees = previousHash != targetCommitHash && !previousCommit.treeHash.empty() &&
+                     !targetCommit.treeHash.empty() &&
+                     diffTrees(objects, previousCommit.treeHash, targetCommit.treeHash, "", changes);
+    if (!fromTrees) {
+        //compares every path, which also rewrites paths whose index entry
+        //disagrees with the target (e.g. after a failed write)
+        changes.clear();
+        unordered_map<string, string> previousBlobs, targetBlobs;
+        if (!previousHash.empty()) previousBlobs = readCommit(previousCopy).fileblobs;
+        CommitNode targetFiles = readCommit(targetCommitHash);
+        if (targetFiles.commitHash.empty()) {
+            cout << "Error: commit " << targetCommitHash << " can't be read, nothing was changed.\n";
+            return false;
+        }
+        targetBlobs.swap(targetFiles.fileblobs);
+        for (const auto& entry : previousBlobs) {
+            if (!targetBlobs.count(entry.first)) changes.push_back({entry.first, entry.second, ""});
+        }
+        for (const auto& entry : targetBlobs) {
+            auto previous = previousBlobs.find(entry.first);
+            auto staged = index.find(entry.first);
+            string previousBlob = previous == previousBlobs.end() ? "" : previous->second;
+            if (previousBlob == entry.second && staged != index.end() && staged->second.blobHash == entry.second) continue;
+            changes.push_back({entry.first, previousBlob, entry.second});
         }
     }
+    diffing.end();
 
-    for (const auto& entry : targetCommit.fileblobs) {
-        const string& filename = entry.first;
-        const string& blobHash = entry.second;
+    if (!updateRef("HEAD", headValue)) {
+        cout << "Error: Could not update HEAD to " << target << endl;
+        return false;
+    }
+    removeFile(MERGE_HEAD_FILE);//switching abandons an unfinished merge
 
-        string blobContent = readFile(OBJECT_DIR + blobHash + "/" + blobHash);
-        if (blobContent.empty() && !fileExists(OBJECT_DIR + blobHash + "/" + blobHash)) {
-            cout << "Warning: Blob " << blobHash << " for file " << filename << " not found. Skipping." <<endl;
+    size_t removed = 0, written = 0;
+    vector<pair<string, string>> writes;
+    for (const TreeChange& change : changes) {
+        if (!change.newBlob.empty()) {
+            writes.push_back({change.path, change.newBlob});
             continue;
         }
-
-        if (!writeFile(filename, blobContent)) {
-            cout << "Error: Could not restore file " << filename <<endl;
-            return false;
-        }
+        removeTrackedFile(change.path);
+        index.erase(change.path);
+        removed++;
     }
+    bool restored = materialize(writes, index);
+    written = writes.size();
 
-    if (!writeFile(STAGING_AREA, "")) {
-        cout << "Warning: Could not clear staging area after checkout." <<endl;
+    if (!writeStagingArea(index)) {
+        cout << "Warning: Could not update staging area after checkout." <<endl;
     }
+    if (!restored) return false;
 
     cout << "Switched to '" << target << "' (" << targetCommitHash << ")" <<endl;
+    if (written || removed) cout << "Updated " << written << " file(s), removed " << removed << "." <<endl;
     return true;
   }  
   
   string getFileContentFromCommit(const CommitNode& commit, const string& filename) {
     auto it = commit.fileblobs.find(filename);
+    string content;
     if (it != commit.fileblobs.end()) {
-        return readFile(OBJECT_DIR + it->second);
+        objects.read(it->second, content);
+    }
+    return content;
+  }
+  
+  //stores content as a blob unless the object store already has it
+  bool storeBlob(const string& blobHash, const char* data, size_t size) {
+    return objects.write(blobHash, OBJ_BLOB, data, size);
+  }
+  
+  //files from chunk.threshold up are stored as chunks, hashed on a pool of
+  //their own since the caller may already be a worker of another pool
+  bool storeBlob(const string& blobHash, const MappedFile& file) {
+    if (chunkThreshold == 0 || file.size() < chunkThreshold) return objects.write(blobHash, OBJ_BLOB, file);
+    ThreadPool* pool;
+    {
+        lock_guard<mutex> guard(chunkPoolLock);
+        if (!chunkPool) chunkPool.reset(new ThreadPool());
+        pool = chunkPool.get();
     }
-    return "";
+    return objects.writeChunked(blobHash, file, chunker, *pool);
   }
   
   void writeBlob(const string& content, const string& blobHash) {
-    writeFile(OBJECT_DIR + blobHash, content);
+    storeBlob(blobHash, content.data(), content.size());
   }
   
-  string findLCA(const string& commitHash1, const string& commitHash2) {
-    set<string> path1;
-    string current = commitHash1;
-    while (!current.empty()) {
-        path1.insert(current);
-        CommitNode c = readCommit(current);
-        current = c.parent;
+  //hashes a working file from its mapping and stores it, returns the blob hash
+  string storeFileAsBlob(const string& filename) {
+    MappedFile file(filename);
+    if (!file.ok()) return "";
+    string blobHash = generateHash(file);
+    storeBlob(blobHash, file);
+    return blobHash;
+  }
+  
+  //streams a blob into a working file, decompressing on the way
+  bool restoreBlob(const string& blobHash, const string& filename) {
+    return objects.restore(blobHash, filename);
+  }
+
+  //removes a file and any directories the removal leaves empty
+  void removeTrackedFile(const string& filename) {
+    removeFile(filename);
+    error_code ec;
+    for (filesystem::path dir = filesystem::path(filename).parent_path(); !dir.empty(); dir = dir.parent_path()) {
+        if (!filesystem::is_empty(dir, ec) || ec || !filesystem::remove(dir, ec)) break;
     }
+  }
+
+  //writes (path, blob) pairs into the working tree on a work-stealing pool
+  //of checkout.workers threads (0 = one per core); blobs in flight are held
+  //to checkout.memoryBudget MiB, written paths get fresh index entries and
+  //failures are reported in path order whatever order the writes ran in
+  bool materialize(vector<pair<string, string>> files, StagingIndex& index) {
+    if (files.empty()) return true;
+    TraceScope scope("materialize");
+    sort(files.begin(), files.end());
+    vector<string> errors(files.size());
+    vector<FileStat> stats(files.size());
+    ThreadPool pool(min<size_t>(max(0L, config.getInt("checkout.workers", 0)), files.size()));
+    MemoryBudget budget(uint64_t(max(1L, config.getInt("checkout.memoryBudget", 256))) << 20);
+    parallelFor(pool, files.size(), [&](size_t i) {
+        TraceScope restore("restore file");
+        const string& filename = files[i].first;
+        const string& blobHash = files[i].second;
+        ObjectInfo info;
+        if (!objects.info(blobHash, info)) {
+            errors[i] = "Blob " + blobHash + " for file " + filename + " not found.";
+            return;
+        }
+        budget.acquire(info.size);
+        filesystem::path parent = filesystem::path(filename).parent_path();
+        if (!parent.empty()) createDirectory(parent.string());
+        if (objects.restore(blobHash, filename, &errors[i])) statFile(filename, stats[i]);
+        budget.release(info.size);
+    });
 
-    current = commitHash2;
-    while (!current.empty()) {
-        if (path1.count(current)) {
-            return current;
+    bool ok = true;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (!errors[i].empty()) {
+            cout << "Error: " << errors[i] << endl;
+            index.erase(files[i].first);//the file's state is unknown now
+            ok = false;
+            continue;
         }
-        CommitNode c = readCommit(current);
-        current = c.parent;
+        IndexEntry& entry = index[files[i].first];
+        entry.blobHash = files[i].second;
+        entry.stat = stats[i];
     }
-    return "";
+    return ok;
+  }
+  
+  //root tree of a commit; commits from before tree objects get one written
+  string commitTree(string commitHash) {
+    CommitNode commit = readCommit(commitHash, false);
+    if (commit.commitHash.empty() || !commit.treeHash.empty()) return commit.treeHash;
+    return writeTree(objects, readCommit(commitHash).fileblobs);
+  }
+
+  //merges a file both sides changed line by line against its merge base
+  //(lcaBlob is empty when both sides added it) and stores the result as a
+  //blob, the working tree is left alone; conflicting regions are kept
+  //between markers and counted in conflicts
+  string mergeFile(const string& lcaBlob, const string& currentBlob,
+                   const string& targetBlob, const string& branchName, size_t& conflicts) {
+    TraceScope scope("merge file");
+    string base, current, target;
+    if ((!lcaBlob.empty() && !objects.read(lcaBlob, base)) ||
+        !objects.read(currentBlob, current) || !objects.read(targetBlob, target)) {
+        return "";
+    }
+    string merged;
+    if (looksBinary(base) || looksBinary(current) || looksBinary(target)) {
+        //binary files can't be merged by line, both versions go between markers
+        conflicts = 1;
+        merged = "<<<<<<< HEAD\n" + current + "=======\n" + target + ">>>>>>> " + branchName + "\n";
+    } else {
+        merged.reserve(max(current.size(), target.size()));
+        conflicts = mergeLines(base, current, target, "HEAD", branchName,
+                               config.get("merge.conflictStyle", "merge") == "diff3", merged);
+    }
+    string blobHash = generateHash(merged);
+    return storeBlob(blobHash, merged.data(), merged.size()) ? blobHash : "";
+  }
+
+  //best common ancestors of two commits, from the commit-graph
+  vector<string> mergeBases(const string& commitHash1, const string& commitHash2) {
+    TraceScope scope("merge bases");
+    uint32_t position1, position2;
+    vector<string> bases;
+    if (!updateCommitGraph(commitHash1) || !updateCommitGraph(commitHash2) ||
+        !graph.find(commitHash1, position1) || !graph.find(commitHash2, position2)) {
+        return bases;
+    }
+    for (uint32_t position : findMergeBases(graph, position1, position2)) bases.push_back(graph.hashAt(position));
+    return bases;
+  }
+
+  //snapshot to merge against; after criss-cross merges there are several
+  //bases and they are first merged into a virtual one, paths the bases
+  //disagree on keep the version of their own merge base
+  unordered_map<string, string> mergeBaseTree(const vector<string>& bases, int depth = 0) {
+    string first = bases[0];
+    unordered_map<string, string> tree = readCommit(first).fileblobs;
+    for (size_t i = 1; i < bases.size(); ++i) {
+        string next = bases[i];
+        unordered_map<string, string> other = readCommit(next).fileblobs;
+        vector<string> deeper = mergeBases(first, next);
+        unordered_map<string, string> ancestor;
+        if (!deeper.empty() && depth < 16) ancestor = mergeBaseTree(deeper, depth + 1);
+
+        set<string> paths;
+        for (const auto& entry : tree) paths.insert(entry.first);
+        for (const auto& entry : other) paths.insert(entry.first);
+        auto blobIn = [](const unordered_map<string, string>& blobs, const string& path) -> string {
+            auto it = blobs.find(path);
+            return it == blobs.end() ? "" : it->second;
+        };
+        unordered_map<string, string> merged;
+        for (const string& path : paths) {
+            string ours = blobIn(tree, path), theirs = blobIn(other, path), base = blobIn(ancestor, path);
+            string result = ours == theirs || theirs == base ? ours : ours == base ? theirs : base;
+            if (!result.empty()) merged[path] = result;
+        }
+        tree.swap(merged);
+    }
+    return tree;
   }
   
   bool mergeBranch(const string& name) {
@@ -378,20 +1557,15 @@ class MiniGit{
         cout <<"Error: initialize Minigit first\n" << "run ./minigit init\n";
         return false;
     }
+    TraceScope scope("merge");
 
     string currentBranchCommitHash = getHeadHash();
-    string targetBranchPath = HEAD_DIR + name;
-
-    if (!fileExists(targetBranchPath)) {
+    string targetBranchCommitHash;
+    if (!readRef(BRANCH_PREFIX + name, targetBranchCommitHash)) {
         cout << "Error: Branch '" << name << "' does not exist.\n";
         return false;
     }
 
-    string targetBranchCommitHash = readFile(targetBranchPath);
-    if (!targetBranchCommitHash.empty() && targetBranchCommitHash.back() == '\n') {
-        targetBranchCommitHash.pop_back();
-    }
-
     if (currentBranchCommitHash.empty() || targetBranchCommitHash.empty()) {
         cout << "Error: One of the branches has no commits to merge.\n";
         return false;
@@ -402,153 +1576,255 @@ class MiniGit{
         return true;
     }
 
-    string lcaHash = findLCA(currentBranchCommitHash, targetBranchCommitHash);
-    if (lcaHash.empty()) {
+    vector<string> bases = mergeBases(currentBranchCommitHash, targetBranchCommitHash);
+    if (bases.empty()) {
         cout << "Error: Could not find a common ancestor for merge.\n";
         return false;
     }
+    if (find(bases.begin(), bases.end(), targetBranchCommitHash) != bases.end()) {
+        cout << "Already up to date.\n";
+        return true;
+    }
+    if (bases.size() > 1) {
+        cout << "Found " << bases.size() << " merge bases, merging them into a virtual base.\n";
+    }
 
-    CommitNode lcaCommit = readCommit(lcaHash);
-    CommitNode currentCommit = readCommit(currentBranchCommitHash);
-    CommitNode targetCommit = readCommit(targetBranchCommitHash);
+    //paths are decided by blob and tree ids, contents are only read for
+    //files both sides changed and only paths whose result differs from
+    //HEAD are written
+    string baseTree = bases.size() == 1 ? commitTree(bases[0]) : writeTree(objects, mergeBaseTree(bases));
+    string currentTree = commitTree(currentBranchCommitHash);
+    string targetTree = commitTree(targetBranchCommitHash);
+    if (baseTree.empty() || currentTree.empty() || targetTree.empty()) {
+        cout << "Error: Could not read the snapshots to merge.\n";
+        return false;
+    }
 
-    unordered_map<string, string> mergedFileBlobs = currentCommit.fileblobs;
-    bool conflictDetected = false;
-    error_code ec;
+    //the first pass only collects the files both sides changed, they are
+    //merged on merge.workers threads (0 = one per core) and the second pass
+    //builds the tree from the results, so it doesn't depend on the thread count
+    struct FileMerge {
+        string path, lcaBlob, currentBlob, targetBlob;
+        string blob;
+        size_t conflicts = 0;
+    };
+    vector<FileMerge> fileMerges;
+    string mergedTree;
+    vector<TreeChange> changes;
+    vector<string> clashes;
+    auto collect = [&](const string& filename, const string& lcaBlob, const string& currentBlob, const string& targetBlob) {
+        fileMerges.push_back({filename, lcaBlob, currentBlob, targetBlob, "", 0});
+        return currentBlob;
+    };
+    TraceScope collecting("merge trees");
+    if (!mergeTrees(objects, baseTree, currentTree, targetTree, "", collect, mergedTree, changes, clashes, false)) {
+        cout << "Error: merge could not combine the two snapshots.\n";
+        return false;
+    }
+    collecting.end();
+    sort(fileMerges.begin(), fileMerges.end(), [](const FileMerge& a, const FileMerge& b){ return a.path < b.path; });
+    if (!fileMerges.empty()) {
+        TraceScope merging("merge files");
+        ThreadPool pool(min<size_t>(max(0L, config.getInt("merge.workers", 0)), fileMerges.size()));
+        parallelFor(pool, fileMerges.size(), [&](size_t i) {
+            FileMerge& file = fileMerges[i];
+            file.blob = mergeFile(file.lcaBlob, file.currentBlob, file.targetBlob, name, file.conflicts);
+        });
+    }
 
-    set<string> allFiles;
-    for (const auto& entry : lcaCommit.fileblobs) allFiles.insert(entry.first);
-    for (const auto& entry : currentCommit.fileblobs) allFiles.insert(entry.first);
-    for (const auto& entry : targetCommit.fileblobs) allFiles.insert(entry.first);
-
-    for (const string& filename : allFiles) {
-        string lcaContent = getFileContentFromCommit(lcaCommit, filename);
-        string currentContent = getFileContentFromCommit(currentCommit, filename);
-        string targetContent = getFileContentFromCommit(targetCommit, filename);
-
-        bool inLCA = lcaCommit.fileblobs.count(filename);
-        bool inCurrent = currentCommit.fileblobs.count(filename);
-        bool inTarget = targetCommit.fileblobs.count(filename);
-
-        if (inCurrent && inTarget) {
-            if (currentContent == targetContent) {
-                string newBlobHash = generateHash(currentContent);
-                writeBlob(currentContent, newBlobHash);
-                mergedFileBlobs[filename] = newBlobHash;
-                writeFile(filename, currentContent);
-            } else if (currentContent == lcaContent) {
-                string newBlobHash = generateHash(targetContent);
-                writeBlob(targetContent, newBlobHash);
-                mergedFileBlobs[filename] = newBlobHash;
-                writeFile(filename, targetContent);
-            } else if (targetContent == lcaContent) {
-                string newBlobHash = generateHash(currentContent);
-                writeBlob(currentContent, newBlobHash);
-                mergedFileBlobs[filename] = newBlobHash;
-                writeFile(filename, currentContent);
-            } else {
-                conflictDetected = true;
-                cout << "CONFLICT: both modified " << filename << endl;
-                string conflictContent = "<<<<<<< HEAD\n" + currentContent +
-                                              "=======\n" + targetContent +
-                                              ">>>>>>> " + name + "\n";
-                string conflictBlobHash = generateHash(conflictContent);
-                writeBlob(conflictContent, conflictBlobHash);
-                writeFile(filename, conflictContent);
-                mergedFileBlobs[filename] = conflictBlobHash;
-            }
-        } else if (inCurrent && !inTarget) {
-            if (inLCA && lcaContent == currentContent) {
-                mergedFileBlobs.erase(filename);
-                removeFile(filename);
-            } else {
-                string newBlobHash = generateHash(currentContent);
-                writeBlob(currentContent, newBlobHash);
-                mergedFileBlobs[filename] = newBlobHash;
-                writeFile(filename, currentContent);
-            }
-        } else if (!inCurrent && inTarget) {
-            if (inLCA && lcaContent == targetContent) {
-                mergedFileBlobs.erase(filename);
-                removeFile(filename);
-            } else {
-                string newBlobHash = generateHash(targetContent);
-                writeBlob(targetContent, newBlobHash);
-                mergedFileBlobs[filename] = newBlobHash;
-                writeFile(filename, targetContent);
-            }
-        } else if (!inLCA && inCurrent && !inTarget) {
-            string newBlobHash = generateHash(currentContent);
-            writeBlob(currentContent, newBlobHash);
-            mergedFileBlobs[filename] = newBlobHash;
-            writeFile(filename, currentContent);
-        } else if (!inLCA && !inCurrent && inTarget) {
-            string newBlobHash = generateHash(targetContent);
-            writeBlob(targetContent, newBlobHash);
-            mergedFileBlobs[filename] = newBlobHash;
-            writeFile(filename, targetContent);
+    //nothing is written to the working tree until every file merged
+    bool conflictDetected = false, failed = false;
+    vector<string> conflicted;
+    unordered_map<string, string> mergedBlobs;
+    for (const FileMerge& file : fileMerges) {
+        if (file.blob.empty()) {
+            failed = true;
+            cout << "Error: could not merge " << file.path << endl;
+        } else if (file.conflicts > 0) {
+            conflictDetected = true;
+            cout << "CONFLICT: both modified " << file.path << " (" << file.conflicts << " conflicting region(s))" << endl;
+            conflicted.push_back(file.path);
+        } else {
+            cout << "Auto-merging " << file.path << endl;
         }
+        mergedBlobs[file.path] = file.blob;
+    }
+    changes.clear();
+    clashes.clear();
+    auto merged = [&](const string& filename, const string&, const string&, const string&) {
+        return mergedBlobs[filename];
+    };
+    TraceScope building("build merged tree");
+    if (failed || !mergeTrees(objects, baseTree, currentTree, targetTree, "", merged, mergedTree, changes, clashes)) {
+        cout << "Error: merge could not combine the two snapshots.\n";
+        return false;
+    }
+    building.end();
+    for (const string& path : clashes) {
+        conflictDetected = true;
+        cout << "CONFLICT (file/directory): " << path << " is a file on one side and a directory on the other, kept HEAD's" << endl;
+    }
+
+    StagingIndex index;
+    if (!readStagingArea(index)) return false;
+    vector<pair<string, string>> writes;
+    for (const TreeChange& change : changes) {
+        if (change.newBlob.empty()) {
+            removeTrackedFile(change.path);
+            index.erase(change.path);
+        } else {
+            writes.push_back({change.path, change.newBlob});
+        }
+    }
+    for (const auto& file : mergedBlobs) writes.push_back(file);
+    //cleanly merged paths are staged either way, conflicted ones keep our entry
+    StagingIndex ours;
+    for (const string& filename : conflicted) {
+        auto entry = index.find(filename);
+        if (entry != index.end()) ours[filename] = entry->second;
+    }
+    if (!materialize(writes, index)) {
+        cout << "Error: merge could not write every file.\n";
+        return false;
+    }
+    for (const string& filename : conflicted) {
+        auto entry = ours.find(filename);
+        if (entry == ours.end()) index.erase(filename);
+        else index[filename] = entry->second;
     }
 
+    writeStagingArea(index);
+    //the next commit records the merged head as its second parent
+    replaceFile(MERGE_HEAD_FILE, targetBranchCommitHash + "\n");
     if (conflictDetected) {
         cout << "Automatic merge failed; fix conflicts in working directory, then 'minigit add .' and 'minigit commit -m \"Merge...\"'.\n";
     } else {
         cout << "Merge successful.\n" ;
 
-        unordered_map<string, string> newStagingArea;
-        for (const auto& entry : mergedFileBlobs) {
-            string content = readFile(entry.first);
-            string newBlobHash = generateHash(content);
-            writeBlob(content, newBlobHash);
-            newStagingArea[entry.first] = newBlobHash;
-        }
-        writeStagingArea(newStagingArea);
-
-        if (!conflictDetected) {
-            string msg = "Merge branch '" + name + "' into " + getHeadHash();
-            commit(msg);
-        }
+        //the merged tree is already written, no need to rebuild it from the index
+        CommitNode mergeCommit("Merge branch '" + name + "' into " + currentBranchCommitHash, currentBranchCommitHash);
+        mergeCommit.parents.push_back(targetBranchCommitHash);
+        mergeCommit.treeHash = mergedTree.empty() ? writeTree(objects, {}) : mergedTree;
+        return writeCommit(mergeCommit);
     }
     return true;
   }
   
-  void diffViewer(const string& f1, const string& f2) {
-    ifstream a(f1), b(f2);
-    if (!a.is_open() || !b.is_open()) {
-        cout << "Error: Could not open one or both files for diff: " << f1 << ", " << f2 << endl;
-        return;
+  //expands an abbreviated id to the object it names, hash is name itself
+  //when that is a full id or nothing starts with it; when several objects
+  //do, one of the preferred type wins if it is alone, otherwise the
+  //candidates are listed (unless report is off) and false is returned
+  bool resolveObjectId(const string& name, ObjectType preferred, string& hash, bool report = true) {
+    hash = name;
+    if (name.size() < MIN_ABBREVIATED_ID || name.size() >= hashHexLength(activeHashAlgorithm) ||
+        name.find_first_not_of("0123456789abcdef") != string::npos || objects.has(name)) {
+        return true;
+    }
+    vector<pair<string, ObjectType>> candidates = objects.findPrefix(name);
+    vector<string> preferredMatches;
+    for (const auto& candidate : candidates) {
+        if (candidate.second == preferred) preferredMatches.push_back(candidate.first);
+    }
+    if (candidates.size() == 1) hash = candidates[0].first;
+    else if (preferredMatches.size() == 1) hash = preferredMatches[0];
+    else if (!candidates.empty()) {
+        if (report) {
+            cout << "Error: short id '" << name << "' is ambiguous, it matches:\n";
+            for (const auto& candidate : candidates) {
+                cout << "  " << candidate.first << " " << objectTypeName(candidate.second) << "\n";
+            }
+        }
+        return false;
     }
+    return true;
+  }
 
-    string la, lb;
-    int line = 1;
-    bool hasDiff = false;
-    while (true) {
-        bool readA = static_cast<bool>(getline(a, la));
-        bool readB = static_cast<bool>(getline(b, lb));
+  //the commit a diff argument names: HEAD, a branch or a (short) commit id
+  string resolveCommit(const string& name) {
+    if (name == "HEAD") return getHeadHash();
+    string hash;
+    if (!readRef(BRANCH_PREFIX + name, hash) && !resolveObjectId(name, OBJ_COMMIT, hash, false)) return "";
+    if (objects.typeOf(hash) != OBJ_COMMIT) return "";
+    string copy = hash;
+    return readCommit(copy, false).commitHash.empty() ? "" : hash;
+  }
 
-        if (!readA && !readB) break;
+  //shows a unified diff of two working tree files, two blobs, or two
+  //commits (every file that differs between their snapshots)
+  bool diff(const string& first, const string& second) {
+    TraceScope scope("diff");
+    string out;
+    if (filesystem::is_regular_file(first) && filesystem::is_regular_file(second)) {
+        MappedFile a(first), b(second);
+        if (!a.ok() || !b.ok()) {
+            cout << "Error: Could not open one or both files for diff: " << first << ", " << second << endl;
+            return false;
+        }
+        if (!unifiedDiff(string_view(a.data(), a.size()), string_view(b.data(), b.size()), first, second, out)) {
+            cout << "Files are identical.\n";
+        }
+        cout << out;
+        return true;
+    }
 
-        if (readA && readB) {
-            if (la != lb) {
-                cout << "Line " << line << ":\n";
-                cout << "=> " << la << endl;
-                cout << "=> " << lb << endl;
-                hasDiff = true;
+    if (!fileExists(MINIGIT_DIR)) {
+        cout <<"Error: initialize Minigit first\n" << "run ./minigit init\n";
+        return false;
+    }
+    string firstCommit = resolveCommit(first), secondCommit = resolveCommit(second);
+    if (!firstCommit.empty() && !secondCommit.empty()) {
+        CommitNode oldCommit = readCommit(firstCommit, false);
+        CommitNode newCommit = readCommit(secondCommit, false);
+        vector<TreeChange> changes;
+        if (!oldCommit.treeHash.empty() && !newCommit.treeHash.empty()) {
+            if (!diffTrees(objects, oldCommit.treeHash, newCommit.treeHash, "", changes)) {
+                cout << "Error: could not read the trees of " << first << " and " << second << endl;
+                return false;
+            }
+        } else {
+            //commits without trees are compared file by file
+            oldCommit = readCommit(firstCommit);
+            newCommit = readCommit(secondCommit);
+            for (const auto& file : oldCommit.fileblobs) {
+                auto other = newCommit.fileblobs.find(file.first);
+                string newBlob = other == newCommit.fileblobs.end() ? "" : other->second;
+                if (newBlob != file.second) changes.push_back({file.first, file.second, newBlob});
+            }
+            for (const auto& file : newCommit.fileblobs) {
+                if (!oldCommit.fileblobs.count(file.first)) changes.push_back({file.first, "", file.second});
+            }
+        }
+        sort(changes.begin(), changes.end(), [](const TreeChange& a, const TreeChange& b){ return a.path < b.path; });
+        for (const TreeChange& change : changes) {
+            string oldData, newData;
+            if ((!change.oldBlob.empty() && !objects.read(change.oldBlob, oldData)) ||
+                (!change.newBlob.empty() && !objects.read(change.newBlob, newData))) {
+                cout << "Error: missing blob for " << change.path << endl;
+                return false;
+            }
+            out += "diff " + change.path + "\n";
+            if (!unifiedDiff(oldData, newData, change.oldBlob.empty() ? "/dev/null" : "a/" + change.path,
+                             change.newBlob.empty() ? "/dev/null" : "b/" + change.path, out)) {
+                out += "(content unchanged)\n";
             }
-        } else if (readA) {
-            cout << "Line " << line << ":\n";
-            cout << "=> " << la << endl;
-            hasDiff = true;
-        } else if (readB) {
-            cout << "Line " << line << ":\n";
-            cout << "=> " << lb << endl;
-            hasDiff = true;
         }
-        line++;
+        cout << out;
+        return true;
     }
-    if (!hasDiff) {
-        cout << "Files are identical.\n";
+
+    string oldData, newData, oldBlob, newBlob;
+    ObjectInfo oldInfo, newInfo;
+    if (!resolveObjectId(first, OBJ_BLOB, oldBlob) || !resolveObjectId(second, OBJ_BLOB, newBlob)) return false;
+    if (objects.read(oldBlob, oldData, &oldInfo) && objects.read(newBlob, newData, &newInfo) &&
+        oldInfo.type == OBJ_BLOB && newInfo.type == OBJ_BLOB) {
+        if (!unifiedDiff(oldData, newData, first, second, out)) {
+            cout << "Blobs are identical.\n";
+        }
+        cout << out;
+        return true;
     }
+    cout << "Error: '" << first << "' and '" << second << "' must both be files, blobs or commits.\n";
+    return false;
   }
   
 };
@@ -0,0 +1,655 @@
+#include "MiniGit.cpp"
+#include <random>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+//benchmarks for minigit, built separately from the cli:
+//  g++ -std=c++17 -O2 benchmark.cpp -o minigit-bench
+//every benchmark works in a scratch directory under the system temp dir
+
+
+double secondsSince(chrono::steady_clock::time_point start){
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+string scratchDir(const string& name){
+  string dir = (filesystem::temp_directory_path() / ("minigit-bench-" + name)).string() + "/";
+  error_code ec;
+  filesystem::remove_all(dir, ec);
+  createDirectory(dir);
+  return dir;
+}
+
+uint64_t directorySize(const string& dir){
+  uint64_t total = 0;
+  error_code ec;
+  for (const auto& entry : filesystem::recursive_directory_iterator(dir, ec)){
+    if (entry.is_regular_file(ec)) total += entry.file_size(ec);
+  }
+  return total;
+}
+
+//source-code-like text: repeated vocabulary with varying identifiers
+string syntheticText(size_t size, mt19937_64& rng){
+  static const char* words[] = {"int", "return", "const", "string&", "if", "else", "for", "while",
+                                "value", "index", "count", "result", "node", "path", "hash", "{", "}", ";"};
+  string out;
+  out.reserve(size + 64);
+  while (out.size() < size){
+    int indent = rng() % 4;
+    out.append(indent * 2, ' ');
+    int wordCount = 3 + rng() % 8;
+    for (int w = 0; w < wordCount; ++w){
+      out += words[rng() % (sizeof(words) / sizeof(words[0]))];
+      if (rng() % 5 == 0) out += to_string(rng() % 1000);
+      out += ' ';
+    }
+    out += '\n';
+  }
+  out.resize(size);
+  return out;
+}
+
+//already-compressed media looks like random bytes to the codec
+string syntheticRandom(size_t size, mt19937_64& rng){
+  string out(size, '\0');
+  for (size_t i = 0; i + 8 <= size; i += 8){
+    uint64_t value = rng();
+    memcpy(&out[i], &value, 8);
+  }
+  return out;
+}
+
+//disk space versus latency of the loose object store at each level
+int benchCompression(size_t megabytes){
+  mt19937_64 rng(42);
+  size_t objectSize = 256 << 10;
+  size_t objectCount = max<size_t>(1, (megabytes << 20) / objectSize);
+  vector<pair<string, vector<string>>> datasets = {{"text", {}}, {"random", {}}};
+  for (size_t i = 0; i < objectCount; ++i){
+    datasets[0].second.push_back(syntheticText(objectSize, rng));
+    datasets[1].second.push_back(syntheticRandom(objectSize, rng));
+  }
+
+  cout << "compression benchmark: " << objectCount << " objects of " << (objectSize >> 10) << " KiB per dataset\n";
+  cout << left << setw(8) << "data" << setw(7) << "level" << setw(12) << "stored MB" << setw(8) << "ratio"
+       << setw(12) << "write MB/s" << setw(12) << "read MB/s" << "\n";
+  for (const auto& dataset : datasets){
+    vector<string> hashes;
+    for (const string& content : dataset.second) hashes.push_back(generateHash(content));
+    double rawMB = double(objectCount * objectSize) / (1 << 20);
+    for (int level : {0, 1, 3, 6, 9}){
+      string dir = scratchDir("compression");
+      ObjectStore store(dir);
+      store.setCompressionLevel(level);
+
+      auto start = chrono::steady_clock::now();
+      for (size_t i = 0; i < objectCount; ++i) store.write(hashes[i], OBJ_BLOB, dataset.second[i]);
+      double writeSeconds = secondsSince(start);
+
+      start = chrono::steady_clock::now();
+      string content;
+      for (size_t i = 0; i < objectCount; ++i) store.read(hashes[i], content);
+      double readSeconds = secondsSince(start);
+
+      double storedMB = double(directorySize(dir)) / (1 << 20);
+      cout << fixed << setprecision(2) << left << setw(8) << dataset.first << setw(7) << level
+           << setw(12) << storedMB << setw(8) << storedMB / rawMB
+           << setw(12) << rawMB / writeSeconds << setw(12) << rawMB / readSeconds << "\n";
+      error_code ec;
+      filesystem::remove_all(dir, ec);
+    }
+  }
+  return 0;
+}
+
+//three-way line merge throughput: both sides edit a large file every
+//spacing lines, theirs half way between ours; every conflictEvery-th edit
+//of theirs hits the same line as ours so the conflict path is measured too
+int benchMerge(size_t megabytes){
+  mt19937_64 rng(7);
+  string baseText = syntheticText(megabytes << 20, rng);
+  baseText += '\n';
+  vector<string> lines;
+  size_t start = 0;
+  while (start < baseText.size()){
+    size_t end = baseText.find('\n', start);
+    lines.push_back(baseText.substr(start, end - start + 1));
+    start = end + 1;
+  }
+
+  cout << "merge benchmark: " << lines.size() << " lines, " << megabytes << " MB per side\n";
+  cout << left << setw(10) << "spacing" << setw(12) << "conflicts" << setw(10) << "seconds" << setw(10) << "MB/s" << "\n";
+  for (size_t spacing : {1000, 100, 10}){
+    for (size_t conflictEvery : {size_t(0), size_t(10)}){
+      string ours, theirs;
+      size_t edit = 0;
+      for (size_t i = 0; i < lines.size(); ++i){
+        bool oursLine = i % spacing == 0;
+        bool theirsLine = i % spacing == spacing / 2;
+        if (oursLine && conflictEvery && ++edit % conflictEvery == 0) theirsLine = true;
+        ours += oursLine ? "ours " + to_string(i) + "\n" : lines[i];
+        theirs += theirsLine ? "theirs " + to_string(i) + "\n" : lines[i];
+      }
+      auto begin = chrono::steady_clock::now();
+      string merged;
+      size_t conflicts = mergeLines(baseText, ours, theirs, "HEAD", "theirs", false, merged);
+      double seconds = secondsSince(begin);
+      cout << fixed << setprecision(3) << left << setw(10) << spacing << setw(12) << conflicts
+           << setw(10) << seconds << setw(10) << setprecision(1) << double(baseText.size()) / (1 << 20) / seconds << "\n";
+    }
+  }
+  return 0;
+}
+
+//merge of two branches that both changed every file of a wide tree, with
+//merge.workers at 1, 4 and one per core; every run starts from a copy of
+//the same repository and must produce the same merged tree
+int benchWideMerge(size_t fileCount){
+  string root = scratchDir("wide-merge");
+  filesystem::path startDir = filesystem::current_path();
+  mt19937_64 rng(11);
+  vector<string> paths;
+  vector<vector<string>> contents;
+  for (size_t i = 0; i < fileCount; ++i){
+    paths.push_back("src/m" + to_string(i % 64) + "/f" + to_string(i) + ".txt");
+    string text = syntheticText(32 << 10, rng);
+    vector<string> lines;
+    stringstream ss(text);
+    string line;
+    while (getline(ss, line)) lines.push_back(line + "\n");
+    contents.push_back(lines);
+  }
+  auto writeVersion = [&](const string& tag, size_t line){
+    for (size_t i = 0; i < fileCount; ++i){
+      string text;
+      for (size_t l = 0; l < contents[i].size(); ++l) text += l == line ? tag + "\n" : contents[i][l];
+      createDirectory(filesystem::path(paths[i]).parent_path().string());
+      writeFile(paths[i], text);
+    }
+  };
+
+  //the template repository: main edits the top of every file, feature the bottom
+  streambuf* console = cout.rdbuf();
+  stringstream discard;
+  cout.rdbuf(discard.rdbuf());
+  filesystem::current_path(root);
+  createDirectory("template");
+  filesystem::current_path(root + "template");
+  {
+    MiniGit git;
+    git.initialize();
+    writeVersion("", size_t(-1));
+    git.addFiles(vector<string>{"."});
+    git.commit("base");
+    git.branching("feature");
+    writeVersion("main edit", 2);
+    git.addFiles(vector<string>{"."});
+    git.commit("main");
+    git.checkOut("feature");
+    writeVersion("feature edit", contents[0].size() - 3);
+    git.addFiles(vector<string>{"."});
+    git.commit("feature");
+    git.checkOut("main");
+  }
+  cout.rdbuf(console);
+
+  cout << "wide merge benchmark: " << fileCount << " files of 32 KiB changed on both sides\n";
+  cout << left << setw(10) << "workers" << setw(10) << "seconds" << setw(12) << "files/s" << "merged tree\n";
+  string firstTree;
+  bool identical = true;
+  size_t run = 0;
+  for (size_t workers : {size_t(1), size_t(4), defaultThreadCount()}){
+    string runDir = root + "run-" + to_string(run++);
+    filesystem::current_path(root);
+    filesystem::copy(root + "template", runDir, filesystem::copy_options::recursive);
+    filesystem::current_path(runDir);
+    RepoConfig config;
+    config.load(CONFIG_FILE);
+    config.set("merge.workers", to_string(workers));
+    config.save(CONFIG_FILE);
+
+    MiniGit git;
+    cout.rdbuf(discard.rdbuf());
+    auto start = chrono::steady_clock::now();
+    git.mergeBranch("feature");
+    double seconds = secondsSince(start);
+    cout.rdbuf(console);
+    string tree = git.commitTree(git.getHeadHash());
+    if (firstTree.empty()) firstTree = tree;
+    identical = identical && tree == firstTree;
+    cout << fixed << setprecision(3) << left << setw(10) << workers << setw(10) << seconds
+         << setw(12) << setprecision(0) << fileCount / seconds << tree.substr(0, 16) << "\n";
+  }
+  filesystem::current_path(startDir);
+  error_code ec;
+  filesystem::remove_all(root, ec);
+  if (!identical){
+    cout << "Error: the merged tree depends on the number of workers\n";
+    return 1;
+  }
+  return 0;
+}
+
+//cost of each core.durability level: 'add .' of many small files (one group
+//sync in batch mode, one per object in strict), the commit on top and a
+//series of ref updates, each of which is synced on its own unless none
+int benchDurability(size_t fileCount){
+  string root = scratchDir("durability");
+  filesystem::path startDir = filesystem::current_path();
+  const size_t refUpdates = 100;
+  streambuf* console = cout.rdbuf();
+  stringstream discard;
+
+  cout << "durability benchmark: " << fileCount << " files of 4 KiB, " << refUpdates << " ref updates\n";
+  cout << left << setw(10) << "level" << setw(10) << "add s" << setw(12) << "files/s" << setw(10) << "commit s"
+       << setw(12) << "ref ms" << "\n";
+  for (const char* level : {"none", "batch", "strict"}){
+    filesystem::current_path(root);
+    createDirectory(level);
+    filesystem::current_path(root + level);
+    mt19937_64 rng(5);
+    cout.rdbuf(discard.rdbuf());
+    {
+      MiniGit git;
+      git.initialize();
+    }
+    RepoConfig config;
+    config.load(CONFIG_FILE);
+    config.set("core.durability", level);
+    config.save(CONFIG_FILE);
+    for (size_t i = 0; i < fileCount; ++i){
+      createDirectory("d" + to_string(i % 32));
+      writeFile("d" + to_string(i % 32) + "/f" + to_string(i), syntheticText(4 << 10, rng));
+    }
+
+    MiniGit git;
+    auto start = chrono::steady_clock::now();
+    git.addFiles(vector<string>{"."});
+    double addSeconds = secondsSince(start);
+    start = chrono::steady_clock::now();
+    git.commit("durability");
+    double commitSeconds = secondsSince(start);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < refUpdates; ++i) git.branching("b" + to_string(i));
+    double refSeconds = secondsSince(start);
+    cout.rdbuf(console);
+    cout << fixed << setprecision(3) << left << setw(10) << level << setw(10) << addSeconds
+         << setw(12) << setprecision(0) << fileCount / addSeconds << setw(10) << setprecision(3) << commitSeconds
+         << setw(12) << refSeconds * 1000 / refUpdates << "\n";
+  }
+  filesystem::current_path(startDir);
+  error_code ec;
+  filesystem::remove_all(root, ec);
+  return 0;
+}
+
+//a large binary file edited in place (one byte in the middle) and then
+//shifted (one byte inserted at the start), stored whole and with content-
+//defined chunking: with chunks each version should only add the chunks
+//around the edit, and checking out the last version from the first must
+//give back its exact bytes
+int benchChunking(size_t megabytes){
+  string root = scratchDir("chunking");
+  filesystem::path startDir = filesystem::current_path();
+  streambuf* console = cout.rdbuf();
+  stringstream discard;
+  mt19937_64 rng(9);
+  string original = syntheticRandom(megabytes << 20, rng);
+  string edited = original;
+  edited[edited.size() / 2] ^= 0x5a;
+  string shifted = "#" + edited;
+
+  cout << "chunking benchmark: " << megabytes << " MB file, 3 versions\n";
+  cout << left << setw(10) << "mode" << setw(10) << "add s" << setw(14) << "v1 MB" << setw(14) << "+edit MB"
+       << setw(14) << "+shift MB" << setw(12) << "checkout s" << "exact\n";
+  bool exact = true;
+  for (const char* mode : {"whole", "chunked"}){
+    createDirectory(root + mode);
+    filesystem::current_path(root + mode);
+    cout.rdbuf(discard.rdbuf());
+    {
+      MiniGit git;
+      git.initialize();
+    }
+    RepoConfig config;
+    config.load(CONFIG_FILE);
+    config.set("chunk.threshold", string(mode) == "whole" ? "0" : "1");
+    config.save(CONFIG_FILE);
+
+    double addSeconds = 0;
+    vector<double> grown;
+    uint64_t size = directorySize(OBJECT_DIR);
+    for (const string* version : {&original, &edited, &shifted}){
+      writeFile("model.bin", *version);
+      MiniGit git;
+      auto start = chrono::steady_clock::now();
+      git.addFiles(vector<string>{"model.bin"});
+      addSeconds += secondsSince(start);
+      git.commit("version");
+      if (version == &original) git.branching("v1");
+      uint64_t now = directorySize(OBJECT_DIR);
+      grown.push_back((now - size) / (1024.0 * 1024.0));
+      size = now;
+    }
+    MiniGit git;
+    git.checkOut("v1");
+    auto start = chrono::steady_clock::now();
+    git.checkOut("main");
+    double checkoutSeconds = secondsSince(start);
+    bool same = readFile("model.bin") == shifted;
+    exact = exact && same;
+    cout.rdbuf(console);
+    cout << fixed << setprecision(3) << left << setw(10) << mode << setw(10) << addSeconds / 3
+         << setprecision(2) << setw(14) << grown[0] << setw(14) << grown[1] << setw(14) << grown[2]
+         << setprecision(3) << setw(12) << checkoutSeconds << (same ? "yes" : "NO") << "\n";
+  }
+  filesystem::current_path(startDir);
+  error_code ec;
+  filesystem::remove_all(root, ec);
+  return exact ? 0 : 1;
+}
+
+//several 'add' processes staging their own directory of one workspace at
+//the same time; only the final merge into the index is serialized, so the
+//throughput should grow with the process count and no entry may get lost
+int benchConcurrentAdd(size_t fileCount){
+  string root = scratchDir("concurrent-add");
+  filesystem::path startDir = filesystem::current_path();
+  streambuf* console = cout.rdbuf();
+  stringstream discard;
+  mt19937_64 rng(3);
+  vector<string> texts;
+  for (size_t i = 0; i < fileCount; ++i) texts.push_back(syntheticText(16 << 10, rng));
+
+  cout << "concurrent add benchmark: " << fileCount << " files of 16 KiB split over the processes\n";
+  cout << left << setw(11) << "processes" << setw(10) << "seconds" << setw(12) << "files/s" << setw(10) << "speedup" << "staged\n";
+  double baseline = 0;
+  bool complete = true;
+  for (size_t processes : {size_t(1), size_t(2), size_t(4), size_t(8)}){
+    string runDir = root + "run-" + to_string(processes) + "/";
+    createDirectory(runDir);
+    filesystem::current_path(runDir);
+    cout.rdbuf(discard.rdbuf());
+    {
+      MiniGit git;
+      git.initialize();
+    }
+    cout.rdbuf(console);
+    for (size_t i = 0; i < fileCount; ++i){
+      string dir = "p" + to_string(i % processes);
+      createDirectory(dir);
+      writeFile(dir + "/f" + to_string(i), texts[i]);
+    }
+
+    cout.flush();
+    auto start = chrono::steady_clock::now();
+    vector<pid_t> children;
+    for (size_t p = 0; p < processes; ++p){
+      pid_t pid = fork();
+      if (pid == 0){
+        cout.rdbuf(discard.rdbuf());
+        MiniGit git;
+        _exit(git.addFiles(vector<string>{"p" + to_string(p)}) ? 0 : 1);
+      }
+      children.push_back(pid);
+    }
+    size_t failures = 0;
+    for (pid_t pid : children){
+      int status = 0;
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failures++;
+    }
+    double seconds = secondsSince(start);
+    if (processes == 1) baseline = seconds;
+
+    StagingIndex index;
+    decodeIndex(readFile(STAGING_AREA), index);
+    complete = complete && failures == 0 && index.size() == fileCount;
+    cout << fixed << setprecision(3) << left << setw(11) << processes << setw(10) << seconds
+         << setw(12) << setprecision(0) << fileCount / seconds << setw(10) << setprecision(2) << baseline / seconds
+         << index.size() << "\n";
+  }
+  filesystem::current_path(startDir);
+  error_code ec;
+  filesystem::remove_all(root, ec);
+  if (!complete){
+    cout << "Error: concurrent adds lost index entries or failed\n";
+    return 1;
+  }
+  return 0;
+}
+
+//cost of the commands run against one synthetic repository, summed over runs
+struct CommandStats {
+  string name;
+  size_t runs = 0;
+  double wallSeconds = 0, userSeconds = 0, systemSeconds = 0;
+  long peakRssKb = 0;
+  //from /proc/self/io: bytes through read/write calls, bytes from and to
+  //storage, and read/write call counts (mapped reads only show in storage)
+  uint64_t readChars = 0, writeChars = 0, readBytes = 0, writeBytes = 0, readCalls = 0, writeCalls = 0;
+  size_t failures = 0;
+};
+
+//runs one command in a forked child against a fresh MiniGit, the way the cli
+//runs it, and adds the child's cost to stats
+void measureCommand(CommandStats& stats, const function<bool(MiniGit&)>& command){
+  cout.flush();
+  int channel[2];
+  if (pipe(channel) != 0) return;
+  auto start = chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid == 0){
+    close(channel[0]);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    bool ok;
+    {
+      MiniGit git;
+      ok = command(git);
+    }
+    cout.flush();
+    stringstream io;
+    io << ifstream("/proc/self/io").rdbuf();
+    string counters = io.str();
+    ssize_t written = write(channel[1], counters.data(), counters.size());
+    _exit(ok && written >= 0 ? 0 : 1);
+  }
+  close(channel[1]);
+  string counters;
+  char buffer[512];
+  ssize_t got;
+  while ((got = read(channel[0], buffer, sizeof(buffer))) > 0) counters.append(buffer, got);
+  close(channel[0]);
+  int status = 0;
+  struct rusage usage;
+  if (pid < 0 || wait4(pid, &status, 0, &usage) != pid) {
+    stats.failures++;
+    return;
+  }
+  stats.wallSeconds += secondsSince(start);
+  stats.runs++;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) stats.failures++;
+  stats.userSeconds += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+  stats.systemSeconds += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  stats.peakRssKb = max(stats.peakRssKb, usage.ru_maxrss);
+  stringstream lines(counters);
+  string key;
+  uint64_t value;
+  while (lines >> key >> value){
+    if (key == "rchar:") stats.readChars += value;
+    else if (key == "wchar:") stats.writeChars += value;
+    else if (key == "read_bytes:") stats.readBytes += value;
+    else if (key == "write_bytes:") stats.writeBytes += value;
+    else if (key == "syscr:") stats.readCalls += value;
+    else if (key == "syscw:") stats.writeCalls += value;
+  }
+}
+
+//every command against a generated repository, reported as json:
+//files with log-uniform sizes in directories depth levels deep, a history
+//of commits each rewriting churn of the files, then branches that each
+//change their own share of the files, checkouts, a diff and the merges
+int benchSuite(const map<string, string>& options){
+  auto option = [&](const string& key, double fallback){
+    auto it = options.find(key);
+    return it == options.end() ? fallback : strtod(it->second.c_str(), nullptr);
+  };
+  size_t fileCount = max<size_t>(1, option("files", 2000));
+  double minKb = max(0.0625, option("min-size", 1)), maxKb = max(minKb, option("max-size", 64));
+  size_t depth = option("depth", 3);
+  size_t commitCount = option("commits", 10);
+  size_t branchCount = max<size_t>(1, option("branches", 4));
+  double churn = min(1.0, max(0.0, option("churn", 0.02)));
+  uint64_t seed = option("seed", 1);
+
+  mt19937_64 rng(seed);
+  string root = scratchDir("suite");
+  filesystem::path startDir = filesystem::current_path();
+  filesystem::current_path(root);
+
+  vector<string> paths;
+  for (size_t i = 0; i < fileCount; ++i){
+    string path;
+    for (size_t level = 0; level < depth; ++level) path += "d" + to_string(rng() % 8) + "/";
+    path += "f" + to_string(i) + ".txt";
+    createDirectory(filesystem::path(path).parent_path().string());
+    double size = minKb * pow(maxKb / minKb, double(rng() % 10000) / 10000) * 1024;
+    writeFile(path, syntheticText(size_t(size), rng));
+    paths.push_back(path);
+  }
+  //appends a line to churn of the files picked from those with index % share == slot
+  auto churnFiles = [&](const string& tag, size_t share, size_t slot){
+    size_t count = max<size_t>(1, size_t(churn * fileCount / share));
+    for (size_t n = 0; n < count; ++n){
+      size_t i = (rng() % max<size_t>(1, fileCount / share)) * share + slot;
+      if (i >= fileCount) i = slot;
+      ofstream(paths[i], ios::app) << tag << " " << n << "\n";
+    }
+  };
+
+  vector<CommandStats> stats;
+  auto statsFor = [&](const string& name) -> CommandStats& {
+    for (CommandStats& entry : stats) if (entry.name == name) return entry;
+    stats.push_back(CommandStats());
+    stats.back().name = name;
+    return stats.back();
+  };
+  auto addAll = [](MiniGit& git){ return git.addFiles(vector<string>{"."}); };
+
+  measureCommand(statsFor("init"), [](MiniGit& git){ return git.initialize(); });
+  measureCommand(statsFor("add-initial"), addAll);
+  measureCommand(statsFor("commit-initial"), [](MiniGit& git){ return git.commit("initial"); });
+  for (size_t c = 0; c < commitCount; ++c){
+    churnFiles("history " + to_string(c), 1, 0);
+    measureCommand(statsFor("add"), addAll);
+    measureCommand(statsFor("commit"), [&](MiniGit& git){ return git.commit("history " + to_string(c)); });
+  }
+  measureCommand(statsFor("log"), [](MiniGit& git){ git.viewLog(); return true; });
+  for (size_t b = 0; b < branchCount; ++b){
+    measureCommand(statsFor("branch"), [&](MiniGit& git){ return git.branching("topic" + to_string(b)); });
+  }
+  for (size_t b = 0; b < branchCount; ++b){
+    measureCommand(statsFor("checkout"), [&](MiniGit& git){ return git.checkOut("topic" + to_string(b)); });
+    churnFiles("topic " + to_string(b), branchCount, b);
+    measureCommand(statsFor("add"), addAll);
+    measureCommand(statsFor("commit"), [&](MiniGit& git){ return git.commit("topic " + to_string(b)); });
+    measureCommand(statsFor("checkout"), [](MiniGit& git){ return git.checkOut("main"); });
+  }
+  measureCommand(statsFor("diff"), [](MiniGit& git){ return git.diff("main", "topic0"); });
+  for (size_t b = 0; b < branchCount; ++b){
+    measureCommand(statsFor("merge"), [&](MiniGit& git){ return git.mergeBranch("topic" + to_string(b)); });
+  }
+  measureCommand(statsFor("log"), [](MiniGit& git){ git.viewLog(); return true; });
+  LogOptions pathLog;
+  pathLog.path = paths[0];
+  measureCommand(statsFor("log-path"), [&](MiniGit& git){ git.viewLog(pathLog); return true; });
+
+  filesystem::current_path(startDir);
+  error_code ec;
+  filesystem::remove_all(root, ec);
+
+  stringstream json;
+  json << "{\n  \"parameters\": {\"files\": " << fileCount << ", \"min_size_kb\": " << minKb
+       << ", \"max_size_kb\": " << maxKb << ", \"depth\": " << depth << ", \"commits\": " << commitCount
+       << ", \"branches\": " << branchCount << ", \"churn\": " << churn << ", \"seed\": " << seed << "},\n";
+  json << "  \"commands\": [\n";
+  for (size_t i = 0; i < stats.size(); ++i){
+    const CommandStats& entry = stats[i];
+    json << fixed << setprecision(6) << "    {\"command\": \"" << entry.name << "\", \"runs\": " << entry.runs
+         << ", \"failures\": " << entry.failures
+         << ", \"wall_seconds\": " << entry.wallSeconds << ", \"user_seconds\": " << entry.userSeconds
+         << ", \"system_seconds\": " << entry.systemSeconds << ", \"peak_rss_kb\": " << entry.peakRssKb
+         << ", \"read_chars\": " << entry.readChars << ", \"write_chars\": " << entry.writeChars
+         << ", \"read_bytes\": " << entry.readBytes << ", \"write_bytes\": " << entry.writeBytes
+         << ", \"read_syscalls\": " << entry.readCalls << ", \"write_syscalls\": " << entry.writeCalls << "}"
+         << (i + 1 < stats.size() ? "," : "") << "\n";
+  }
+  json << "  ]\n}\n";
+
+  auto output = options.find("output");
+  if (output != options.end()){
+    if (!writeFile(output->second, json.str())) return 1;
+  } else {
+    cout << json.str();
+  }
+  for (const CommandStats& entry : stats) if (entry.failures) return 1;
+  return 0;
+}
+
+void benchUsage(){
+  cout << "usage: ./minigit-bench <benchmark> [options]\n";
+  cout << "  compression [MB]    disk space and latency of each compression level (default 32 MB)\n";
+  cout << "  merge [MB]          three-way line merge throughput on a large file (default 16 MB)\n";
+  cout << "  wide-merge [files]  merge of a branch changing every file at 1, 4 and N workers (default 2000)\n";
+  cout << "  concurrent-add [files] 1, 2, 4 and 8 'add' processes sharing one index (default 4000)\n";
+  cout << "  chunking [MB]       store growth of small edits to a large binary, whole and chunked (default 256 MB)\n";
+  cout << "  durability [files]  add, commit and ref update cost of core.durability none/batch/strict (default 5000)\n";
+  cout << "  suite [--key=value] every command on a generated repository, json per command; keys:\n";
+  cout << "                      files (2000), min-size/max-size KiB (1/64), depth (3), commits (10),\n";
+  cout << "                      branches (4), churn fraction per commit (0.02), seed (1), output file\n";
+}
+
+int main(int argc, char* argv[]){
+  if (argc < 2){
+    benchUsage();
+    return 1;
+  }
+  string name = argv[1];
+  if (name == "compression"){
+    return benchCompression(argc > 2 ? strtoul(argv[2], nullptr, 10) : 32);
+  }
+  if (name == "merge"){
+    return benchMerge(argc > 2 ? strtoul(argv[2], nullptr, 10) : 16);
+  }
+  if (name == "suite"){
+    map<string, string> options;
+    for (int i = 2; i < argc; ++i){
+      string arg = argv[i];
+      size_t eq = arg.find('=');
+      if (arg.rfind("--", 0) != 0 || eq == string::npos){
+        benchUsage();
+        return 1;
+      }
+      options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+    return benchSuite(options);
+  }
+  if (name == "chunking"){
+    return benchChunking(argc > 2 ? strtoul(argv[2], nullptr, 10) : 256);
+  }
+  if (name == "wide-merge"){
+    return benchWideMerge(argc > 2 ? strtoul(argv[2], nullptr, 10) : 2000);
+  }
+  if (name == "concurrent-add"){
+    return benchConcurrentAdd(argc > 2 ? strtoul(argv[2], nullptr, 10) : 4000);
+  }
+  if (name == "durability"){
+    return benchDurability(argc > 2 ? strtoul(argv[2], nullptr, 10) : 5000);
+  }
+  benchUsage();
+  return 1;
+}
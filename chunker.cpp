@@ -0,0 +1,140 @@
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+
+using namespace std;
+
+//this file includes the content-defined chunking of large files
+//a file above chunk.threshold is cut into chunks where a rolling hash of
+//the last 64 bytes hits a pattern (FastCDC), so an edit only changes the
+//chunks around it and the rest keep their ids: every chunk is stored once
+//as a blob, across versions and across files, and the file itself is a
+//chunk list object under the id of its whole content:
+//  "MGCK", u8 version, u8 hash bytes, varint total size, varint chunk count,
+//  then per chunk varint size + raw id
+//cut points use normalized chunking: below the average size the pattern
+//needs two more zero bits, above it two fewer, which keeps sizes close to
+//the average; chunks are never shorter than a quarter of it (except the
+//last) or longer than four times it
+
+const char CHUNK_LIST_MAGIC[4] = {'M', 'G', 'C', 'K'};
+const uint8_t CHUNK_LIST_VERSION = 1;
+
+struct ChunkRef {
+  string hash;//hex
+  uint64_t size = 0;
+};
+
+//the gear table, 256 random words from splitmix64 with a fixed seed; it is
+//part of the format, other values would move every cut point
+constexpr array<uint64_t, 256> makeGearTable(){
+  array<uint64_t, 256> table = {};
+  uint64_t state = 0x6d696e6967697421ULL;
+  for (size_t i = 0; i < table.size(); ++i){
+    state += 0x9e3779b97f4a7c15ULL;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    table[i] = z ^ (z >> 31);
+  }
+  return table;
+}
+
+constexpr array<uint64_t, 256> GEAR_TABLE = makeGearTable();
+
+class Chunker {
+  private:
+    size_t minSize;
+    size_t averageSize;
+    size_t maxSize;
+    uint64_t hardMask;//before the average size
+    uint64_t easyMask;//after it
+
+    //the top bits of the hash, they depend on the most input bytes
+    static uint64_t topBits(int bits){
+      return bits <= 0 ? 0 : ~0ULL << (64 - bits);
+    }
+
+  public:
+    //averageBytes is rounded down to a power of two, at least 4 KiB
+    explicit Chunker(size_t averageBytes){
+      int bits = 12;
+      while (bits < 30 && (size_t(1) << (bits + 1)) <= averageBytes) bits++;
+      averageSize = size_t(1) << bits;
+      minSize = averageSize / 4;
+      maxSize = averageSize * 4;
+      hardMask = topBits(bits + 2);
+      easyMask = topBits(bits - 2);
+    }
+
+    size_t maxChunkSize() const { return maxSize; }
+
+    //length of the chunk that starts at data
+    size_t cut(const uint8_t* data, size_t size) const {
+      if (size <= minSize) return size;
+      size_t end = min(size, maxSize), normal = min(end, averageSize);
+      uint64_t hash = 0;
+      size_t i = minSize;
+      for (; i < normal; ++i){
+        hash = (hash << 1) + GEAR_TABLE[data[i]];
+        if (!(hash & hardMask)) return i + 1;
+      }
+      for (; i < end; ++i){
+        hash = (hash << 1) + GEAR_TABLE[data[i]];
+        if (!(hash & easyMask)) return i + 1;
+      }
+      return end;
+    }
+
+    //(offset, length) of every chunk of a buffer, in order
+    vector<pair<size_t, size_t>> split(const char* data, size_t size) const {
+      vector<pair<size_t, size_t>> chunks;
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+      for (size_t offset = 0; offset < size;){
+        size_t length = cut(bytes + offset, size - offset);
+        chunks.push_back({offset, length});
+        offset += length;
+      }
+      return chunks;
+    }
+};
+
+//returns "" if an id isn't hex or the ids differ in length
+string encodeChunkList(const vector<ChunkRef>& chunks, uint64_t totalSize){
+  string out(CHUNK_LIST_MAGIC, 4);
+  out.push_back(char(CHUNK_LIST_VERSION));
+  size_t hashBytes = chunks.empty() ? 0 : chunks[0].hash.size() / 2;
+  out.push_back(char(hashBytes));
+  putVarint(out, totalSize);
+  putVarint(out, chunks.size());
+  for (const ChunkRef& chunk : chunks){
+    string raw = hexToBytes(chunk.hash);
+    if (raw.empty() || raw.size() != hashBytes) return "";
+    putVarint(out, chunk.size);
+    out += raw;
+  }
+  return out;
+}
+
+bool decodeChunkList(const char* data, size_t size, vector<ChunkRef>& chunks, uint64_t& totalSize){
+  chunks.clear();
+  if (size < 6 || memcmp(data, CHUNK_LIST_MAGIC, 4) != 0) return false;
+  ByteReader reader(data + 4, size - 4);
+  if (reader.u8() != CHUNK_LIST_VERSION) return false;
+  uint8_t hashBytes = reader.u8();
+  totalSize = reader.varint();
+  uint64_t count = reader.varint();
+  if (!reader.ok() || hashBytes == 0 || count > reader.remaining()) return false;
+  uint64_t sum = 0;
+  for (uint64_t i = 0; i < count; ++i){
+    ChunkRef chunk;
+    chunk.size = reader.varint();
+    const char* raw = reader.take(hashBytes);
+    if (!raw) return false;
+    chunk.hash = toHex(reinterpret_cast<const uint8_t*>(raw), hashBytes);
+    sum += chunk.size;
+    chunks.push_back(move(chunk));
+  }
+  return reader.ok() && sum == totalSize;
+}
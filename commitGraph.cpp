@@ -0,0 +1,584 @@
+#include <string>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <queue>
+#include <string_view>
+
+using namespace std;
+
+//this file includes the commit-graph, a cache of the history that log and
+//ancestry queries read from memory-mapped files instead of parsing one
+//commit object per step
+//commits get global positions in the order they were added (parents first);
+//the graph is a chain of layers, each covering a run of positions, listed
+//bottom to top in commit-graph/graph-chain. A new commit adds a small layer
+//on top, and layers are merged once the top one is at least half the size
+//of the one below, so the chain stays logarithmic in the number of commits
+//layer file:
+//  "MGCG", u32 version, u32 hash bytes, u32 count, u32 first position,
+//  u32 extra edge count, u32 pool size, u32 fanout[256],
+//  sorted hashes + u32 local index of each,
+//  hashes in position order,
+//  records: u32 parent1, u32 parent2, u32 generation, u32 pool offset, u64 time,
+//  extra edges (u32), string pool (varint length + timestamp, varint length + message),
+//  u32 end of each commit's path filter, path filters back to back
+//a missing parent is GRAPH_NO_PARENT; a parent2 with GRAPH_EXTRA_EDGES set
+//indexes the extra edges, which list the remaining parents, the last one
+//flagged with GRAPH_EXTRA_EDGES
+//a path filter is a Bloom filter of the paths (and their directories) a
+//commit changed from its first parent, so 'log -- <path>' skips most
+//commits without reading their trees; an empty filter means unknown, as
+//for commits that changed too many paths and for version 1 layers, which
+//have none
+
+const char GRAPH_MAGIC[4] = {'M', 'G', 'C', 'G'};
+const uint32_t GRAPH_VERSION = 2;
+const uint32_t GRAPH_VERSION_NO_FILTERS = 1;
+const uint32_t GRAPH_NO_PARENT = 0xffffffff;
+const uint32_t GRAPH_EXTRA_EDGES = 0x80000000;
+const size_t GRAPH_HEADER_SIZE = 28 + 256 * 4;
+const size_t GRAPH_RECORD_SIZE = 24;
+
+//about 1% false positives at 7 probes, commits that changed more paths
+//than PATH_FILTER_MAX_PATHS get no filter rather than a useless one
+const uint32_t PATH_FILTER_BITS_PER_PATH = 10;
+const uint32_t PATH_FILTER_PROBES = 7;
+const size_t PATH_FILTER_MAX_PATHS = 512;
+//filters of commits that changed a file or two would be a few bits wide
+//and match far more often than the rate above
+const size_t PATH_FILTER_MIN_BYTES = 8;
+
+//a commit as it is handed to the graph, parents by id
+struct GraphCommit {
+  string hash;
+  vector<string> parents;
+  string timestamp;
+  string message;
+  string pathFilter;//from buildPathFilter, "" when unknown
+};
+
+//a commit as it is stored, parents by position
+struct GraphRecord {
+  string binaryHash;
+  vector<uint32_t> parents;
+  uint32_t generation = 0;
+  uint64_t time = 0;
+  string timestamp;
+  string message;
+  string pathFilter;
+};
+
+//the two halves of a 64-bit FNV-1a hash of a path drive the probes
+//(double hashing), so a lookup hashes the path once
+uint64_t pathFilterHash(const string_view& path){
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char c : path){
+    hash ^= uint8_t(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+void setPathFilterBits(string& filter, const string_view& path){
+  uint64_t hash = pathFilterHash(path);
+  uint32_t h1 = uint32_t(hash), h2 = uint32_t(hash >> 32) | 1;
+  uint64_t bits = uint64_t(filter.size()) * 8;
+  for (uint32_t i = 0; i < PATH_FILTER_PROBES; ++i){
+    uint64_t bit = (h1 + uint64_t(i) * h2) % bits;
+    filter[bit / 8] = char(filter[bit / 8] | (1 << (bit % 8)));
+  }
+}
+
+//the filter of a commit that changed these files from its first parent;
+//every leading directory goes in as well so directories can be queried
+string buildPathFilter(const vector<string>& changedFiles){
+  vector<string_view> paths;
+  for (const string& file : changedFiles){
+    for (size_t slash = file.find('/'); slash != string::npos; slash = file.find('/', slash + 1)){
+      paths.push_back(string_view(file).substr(0, slash));
+    }
+    paths.push_back(file);
+  }
+  sort(paths.begin(), paths.end());
+  paths.erase(unique(paths.begin(), paths.end()), paths.end());
+  if (paths.size() > PATH_FILTER_MAX_PATHS) return "";
+  //never empty, so a commit that changed nothing still rules every path out
+  string filter(max(PATH_FILTER_MIN_BYTES, (paths.size() * PATH_FILTER_BITS_PER_PATH + 7) / 8), '\0');
+  for (const string_view& path : paths) setPathFilterBits(filter, path);
+  return filter;
+}
+
+//false only if the commit certainly didn't change path
+bool pathFilterMayContain(const string_view& filter, const string_view& path){
+  if (filter.empty()) return true;
+  uint64_t hash = pathFilterHash(path);
+  uint32_t h1 = uint32_t(hash), h2 = uint32_t(hash >> 32) | 1;
+  uint64_t bits = uint64_t(filter.size()) * 8;
+  for (uint32_t i = 0; i < PATH_FILTER_PROBES; ++i){
+    uint64_t bit = (h1 + uint64_t(i) * h2) % bits;
+    if (!(uint8_t(filter[bit / 8]) & (1 << (bit % 8)))) return false;
+  }
+  return true;
+}
+
+//seconds since the epoch of a commit timestamp written by getCurrentTime
+uint64_t parseCommitTime(const string& timestamp){
+  tm parts = {};
+  if (sscanf(timestamp.c_str(), "%d/%d/%d %d:%d:%d", &parts.tm_year, &parts.tm_mon, &parts.tm_mday,
+             &parts.tm_hour, &parts.tm_min, &parts.tm_sec) != 6) {
+    return 0;
+  }
+  parts.tm_year -= 1900;
+  parts.tm_mon -= 1;
+  parts.tm_isdst = -1;
+  time_t seconds = mktime(&parts);
+  return seconds < 0 ? 0 : uint64_t(seconds);
+}
+
+//seconds since the epoch of a --since/--until date, "2024-05-01" or
+//"2024/05/01" with an optional " 13:45[:10]"; a bare date covers the
+//whole day, so it is taken as its last second when endOfDay is set
+bool parseLogDate(const string& text, bool endOfDay, uint64_t& seconds){
+  string date = text;
+  replace(date.begin(), date.end(), '-', '/');
+  tm parts = {};
+  int fields = sscanf(date.c_str(), "%d/%d/%d %d:%d:%d", &parts.tm_year, &parts.tm_mon, &parts.tm_mday,
+                      &parts.tm_hour, &parts.tm_min, &parts.tm_sec);
+  if (fields < 3 || fields == 4) return false;
+  if (fields == 3 && endOfDay){
+    parts.tm_hour = 23;
+    parts.tm_min = 59;
+    parts.tm_sec = 59;
+  }
+  parts.tm_year -= 1900;
+  parts.tm_mon -= 1;
+  parts.tm_isdst = -1;
+  time_t result = mktime(&parts);
+  if (result < 0) return false;
+  seconds = uint64_t(result);
+  return true;
+}
+
+class GraphLayer {
+  private:
+    unique_ptr<MappedFile> file;
+    const char* fanout = nullptr;
+    const char* sortedHashes = nullptr;
+    const char* sortedIndex = nullptr;
+    const char* hashes = nullptr;
+    const char* records = nullptr;
+    const char* extraEdges = nullptr;
+    const char* pool = nullptr;
+    const char* filterEnds = nullptr;
+    const char* filters = nullptr;
+    uint32_t extraCount = 0;
+    uint32_t poolSize = 0;
+
+  public:
+    string name;
+    uint32_t hashBytes = 0;
+    uint32_t count = 0;
+    uint32_t first = 0;
+
+    bool open(const string& path){
+      file.reset(new MappedFile(path));
+      if (!file->ok() || file->size() < GRAPH_HEADER_SIZE || memcmp(file->data(), GRAPH_MAGIC, 4) != 0) return false;
+      const char* data = file->data();
+      uint32_t version = getU32(data + 4);
+      if (version != GRAPH_VERSION && version != GRAPH_VERSION_NO_FILTERS) return false;
+      hashBytes = getU32(data + 8);
+      count = getU32(data + 12);
+      first = getU32(data + 16);
+      extraCount = getU32(data + 20);
+      poolSize = getU32(data + 24);
+      fanout = data + 28;
+      sortedHashes = data + GRAPH_HEADER_SIZE;
+      sortedIndex = sortedHashes + size_t(count) * hashBytes;
+      hashes = sortedIndex + size_t(count) * 4;
+      records = hashes + size_t(count) * hashBytes;
+      extraEdges = records + size_t(count) * GRAPH_RECORD_SIZE;
+      pool = extraEdges + size_t(extraCount) * 4;
+      size_t end = size_t(pool - data) + poolSize;
+      if (getU32(fanout + 255 * 4) != count) return false;
+      if (version == GRAPH_VERSION_NO_FILTERS) return end == file->size();
+      filterEnds = pool + poolSize;
+      filters = filterEnds + size_t(count) * 4;
+      end += size_t(count) * 4;
+      return end <= file->size() && end + (count ? getU32(filterEnds + size_t(count - 1) * 4) : 0) == file->size();
+    }
+
+    //local index of a raw hash, -1 when it isn't in this layer
+    int64_t find(const string& binaryHash) const {
+      if (binaryHash.size() != hashBytes || count == 0) return -1;
+      uint8_t lead = uint8_t(binaryHash[0]);
+      uint32_t low = lead == 0 ? 0 : getU32(fanout + (lead - 1) * 4);
+      uint32_t high = getU32(fanout + lead * 4);
+      while (low < high){
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = memcmp(sortedHashes + size_t(mid) * hashBytes, binaryHash.data(), hashBytes);
+        if (cmp == 0) return getU32(sortedIndex + size_t(mid) * 4);
+        if (cmp < 0) low = mid + 1;
+        else high = mid;
+      }
+      return -1;
+    }
+
+    const char* hashAt(uint32_t local) const { return hashes + size_t(local) * hashBytes; }
+    const char* record(uint32_t local) const { return records + size_t(local) * GRAPH_RECORD_SIZE; }
+
+    void parents(uint32_t local, vector<uint32_t>& out) const {
+      out.clear();
+      const char* r = record(local);
+      uint32_t parent1 = getU32(r), second = getU32(r + 4);
+      if (parent1 == GRAPH_NO_PARENT) return;
+      out.push_back(parent1);
+      if (second == GRAPH_NO_PARENT) return;
+      if (!(second & GRAPH_EXTRA_EDGES)){
+        out.push_back(second);
+        return;
+      }
+      for (uint32_t i = second & ~GRAPH_EXTRA_EDGES; i < extraCount; ++i){
+        uint32_t edge = getU32(extraEdges + size_t(i) * 4);
+        out.push_back(edge & ~GRAPH_EXTRA_EDGES);
+        if (edge & GRAPH_EXTRA_EDGES) break;
+      }
+    }
+
+    //timestamp string and message of a commit
+    void strings(uint32_t local, string& timestamp, string& message) const {
+      uint32_t offset = getU32(record(local) + 12);
+      if (offset > poolSize) return;
+      ByteReader reader(pool + offset, poolSize - offset);
+      timestamp = reader.bytes(reader.varint());
+      message = reader.bytes(reader.varint());
+    }
+
+    bool hasFilters() const { return filters != nullptr; }
+
+    //the path filter of a commit, empty when the layer has none
+    string_view pathFilter(uint32_t local) const {
+      if (!filters) return string_view();
+      uint32_t begin = local == 0 ? 0 : getU32(filterEnds + size_t(local - 1) * 4);
+      uint32_t end = getU32(filterEnds + size_t(local) * 4);
+      return begin <= end ? string_view(filters + begin, end - begin) : string_view();
+    }
+
+    GraphRecord decode(uint32_t local) const {
+      GraphRecord result;
+      result.binaryHash.assign(hashAt(local), hashBytes);
+      parents(local, result.parents);
+      result.generation = getU32(record(local) + 8);
+      result.time = getU64(record(local) + 16);
+      strings(local, result.timestamp, result.message);
+      result.pathFilter = string(pathFilter(local));
+      return result;
+    }
+};
+
+//builds the file image of a layer whose records start at position first
+string encodeGraphLayer(const vector<GraphRecord>& records, uint32_t first, uint32_t hashBytes){
+  string extra, pool, recordData, hashes, filterEnds, filters;
+  for (const GraphRecord& r : records){
+    hashes += r.binaryHash;
+    filters += r.pathFilter;
+    putU32(filterEnds, uint32_t(filters.size()));
+    uint32_t parent1 = r.parents.empty() ? GRAPH_NO_PARENT : r.parents[0];
+    uint32_t parent2 = r.parents.size() < 2 ? GRAPH_NO_PARENT : r.parents[1];
+    if (r.parents.size() > 2){
+      parent2 = uint32_t(extra.size() / 4) | GRAPH_EXTRA_EDGES;
+      for (size_t i = 1; i < r.parents.size(); ++i){
+        putU32(extra, r.parents[i] | (i + 1 == r.parents.size() ? GRAPH_EXTRA_EDGES : 0));
+      }
+    }
+    putU32(recordData, parent1);
+    putU32(recordData, parent2);
+    putU32(recordData, r.generation);
+    putU32(recordData, uint32_t(pool.size()));
+    putU64(recordData, r.time);
+    putVarint(pool, r.timestamp.size());
+    pool += r.timestamp;
+    putVarint(pool, r.message.size());
+    pool += r.message;
+  }
+
+  vector<uint32_t> order(records.size());
+  for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+  sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){ return records[a].binaryHash < records[b].binaryHash; });
+
+  string out(GRAPH_MAGIC, 4);
+  putU32(out, GRAPH_VERSION);
+  putU32(out, hashBytes);
+  putU32(out, records.size());
+  putU32(out, first);
+  putU32(out, extra.size() / 4);
+  putU32(out, pool.size());
+  uint32_t fanout[256] = {0};
+  for (const GraphRecord& r : records) fanout[uint8_t(r.binaryHash[0])]++;
+  uint32_t running = 0;
+  for (int i = 0; i < 256; ++i){
+    running += fanout[i];
+    putU32(out, running);
+  }
+  for (uint32_t i : order) out += records[i].binaryHash;
+  for (uint32_t i : order) putU32(out, i);
+  out += hashes;
+  out += recordData;
+  out += extra;
+  out += pool;
+  out += filterEnds;
+  out += filters;
+  return out;
+}
+
+class CommitGraph {
+  private:
+    string dir;
+    vector<unique_ptr<GraphLayer>> layers;//bottom first
+    bool loaded = false;
+
+    string chainPath() const { return dir + "graph-chain"; }
+
+    void load(){
+      layers.clear();
+      loaded = true;
+      stringstream chain(fileExists(chainPath()) ? readFile(chainPath()) : "");
+      string name;
+      uint32_t expected = 0;
+      while (getline(chain, name)){
+        if (name.empty()) continue;
+        unique_ptr<GraphLayer> layer(new GraphLayer());
+        layer->name = name;
+        //a damaged or out of order layer drops it and everything above it
+        if (!layer->open(dir + name) || layer->first != expected) break;
+        expected += layer->count;
+        layers.push_back(move(layer));
+      }
+    }
+
+    const GraphLayer* layerOf(uint32_t position, uint32_t& local){
+      for (auto it = layers.rbegin(); it != layers.rend(); ++it){
+        if (position >= (*it)->first){
+          local = position - (*it)->first;
+          return local < (*it)->count ? it->get() : nullptr;
+        }
+      }
+      return nullptr;
+    }
+
+    //writes a layer file and returns its name
+    bool writeLayer(const vector<GraphRecord>& records, uint32_t first, uint32_t hashBytes, string& name){
+      string data = encodeGraphLayer(records, first, hashBytes);
+      name = "graph-" + hashWith(HASH_BLAKE3, data.data(), data.size()).substr(0, 40) + ".graph";
+      return writeFile(dir + name, data.data(), data.size(), WRITE_BATCHED);
+    }
+
+    bool writeChain(const vector<string>& names){
+      string chain;
+      for (const string& name : names) chain += name + "\n";
+      return replaceFile(chainPath(), chain);
+    }
+
+  public:
+    explicit CommitGraph(const string& graphDir) : dir(graphDir){}
+
+    uint32_t size(){
+      if (!loaded) load();
+      return layers.empty() ? 0 : layers.back()->first + layers.back()->count;
+    }
+
+    bool find(const string& hash, uint32_t& position){
+      if (!loaded) load();
+      string binaryHash = hexToBytes(hash);
+      if (binaryHash.empty()) return false;
+      for (const auto& layer : layers){
+        int64_t local = layer->find(binaryHash);
+        if (local >= 0){
+          position = layer->first + uint32_t(local);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    string hashAt(uint32_t position){
+      uint32_t local;
+      const GraphLayer* layer = layerOf(position, local);
+      return layer ? toHex(reinterpret_cast<const uint8_t*>(layer->hashAt(local)), layer->hashBytes) : "";
+    }
+
+    void parents(uint32_t position, vector<uint32_t>& out){
+      uint32_t local;
+      const GraphLayer* layer = layerOf(position, local);
+      if (layer) layer->parents(local, out);
+      else out.clear();
+    }
+
+    uint32_t generation(uint32_t position){
+      uint32_t local;
+      const GraphLayer* layer = layerOf(position, local);
+      return layer ? getU32(layer->record(local) + 8) : 0;
+    }
+
+    uint64_t commitTime(uint32_t position){
+      uint32_t local;
+      const GraphLayer* layer = layerOf(position, local);
+      return layer ? getU64(layer->record(local) + 16) : 0;
+    }
+
+    //false only if the commit certainly didn't change path (a file or a
+    //directory) from its first parent
+    bool mayHaveChanged(uint32_t position, const string& path){
+      uint32_t local;
+      const GraphLayer* layer = layerOf(position, local);
+      return !layer || pathFilterMayContain(layer->pathFilter(local), path);
+    }
+
+    //whether every commit has had its changed paths recorded; layers
+    //written before path filters existed don't know them
+    bool hasPathFilters(){
+      if (!loaded) load();
+      for (const auto& layer : layers){
+        if (!layer->hasFilters()) return false;
+      }
+      return true;
+    }
+
+    void describe(uint32_t position, string& timestamp, string& message){
+      uint32_t local;
+      const GraphLayer* layer = layerOf(position, local);
+      if (layer) layer->strings(local, timestamp, message);
+    }
+
+    //adds commits in parents-first order; every parent must already be in
+    //the graph or earlier in the list
+    bool append(const vector<GraphCommit>& commits){
+      if (commits.empty()) return true;
+      uint32_t first = size();
+      uint32_t hashBytes = layers.empty() ? hexToBytes(commits[0].hash).size() : layers.back()->hashBytes;
+      unordered_map<string, uint32_t> added;
+      vector<GraphRecord> records;
+      for (const GraphCommit& c : commits){
+        GraphRecord r;
+        r.binaryHash = hexToBytes(c.hash);
+        if (r.binaryHash.size() != hashBytes) return false;
+        for (const string& parent : c.parents){
+          uint32_t position;
+          auto it = added.find(parent);
+          if (it != added.end()) position = it->second;
+          else if (!find(parent, position)) return false;
+          r.parents.push_back(position);
+          uint32_t parentGeneration = position >= first ? records[position - first].generation : generation(position);
+          r.generation = max(r.generation, parentGeneration);
+        }
+        r.generation++;
+        r.time = parseCommitTime(c.timestamp);
+        r.timestamp = c.timestamp;
+        r.message = c.message;
+        r.pathFilter = c.pathFilter;
+        added[c.hash] = first + records.size();
+        records.push_back(move(r));
+      }
+
+      //fold in the layers that are no more than twice the size of what sits on them
+      size_t keep = layers.size();
+      while (keep > 0 && layers[keep - 1]->count <= 2 * records.size()){
+        const GraphLayer& below = *layers[keep - 1];
+        vector<GraphRecord> merged;
+        merged.reserve(below.count + records.size());
+        for (uint32_t i = 0; i < below.count; ++i) merged.push_back(below.decode(i));
+        for (GraphRecord& r : records) merged.push_back(move(r));
+        records.swap(merged);
+        first = below.first;
+        keep--;
+      }
+
+      createDirectory(dir);
+      string name;
+      if (!writeLayer(records, first, hashBytes, name)) return false;
+      vector<string> names, dropped;
+      for (size_t i = 0; i < layers.size(); ++i){
+        if (i < keep) names.push_back(layers[i]->name);
+        else dropped.push_back(layers[i]->name);
+      }
+      names.push_back(name);
+      if (!writeChain(names)) return false;
+      error_code ec;
+      for (const string& old : dropped) if (old != name) filesystem::remove(dir + old, ec);
+      load();
+      return true;
+    }
+
+    //forgets the graph, used when every commit id changes
+    void clear(){
+      error_code ec;
+      filesystem::remove_all(dir, ec);
+      layers.clear();
+      loaded = false;
+    }
+};
+
+//paint flags of the merge-base walk
+enum : uint8_t {
+  PAINT_ONE = 1,
+  PAINT_TWO = 2,
+  PAINT_STALE = 4,
+  PAINT_RESULT = 8,
+  PAINT_QUEUED = 16,
+};
+
+//best common ancestors of one and two: common ancestors that aren't an
+//ancestor of another common ancestor (several after criss-cross merges)
+//both sides are walked together from a queue ordered by generation, so a
+//commit is only visited once all its descendants in the walk were; the
+//walk stops when every queued commit is already below a common ancestor
+//and only touches the part of the history above the merge bases
+vector<uint32_t> findMergeBases(CommitGraph& graph, uint32_t one, uint32_t two){
+  if (one == two) return {one};
+  unordered_map<uint32_t, uint8_t> flags;
+  priority_queue<pair<uint32_t, uint32_t>> queue;//(generation, position)
+  size_t active = 0;//queued commits without PAINT_STALE
+  auto paint = [&](uint32_t position, uint8_t paint){
+    uint8_t& current = flags[position];
+    bool wasActive = (current & PAINT_QUEUED) && !(current & PAINT_STALE);
+    current |= paint;
+    if (!(current & PAINT_QUEUED)){
+      current |= PAINT_QUEUED;
+      queue.push({graph.generation(position), position});
+      if (!(current & PAINT_STALE)) active++;
+    } else if (wasActive && (current & PAINT_STALE)){
+      active--;
+    }
+  };
+  paint(one, PAINT_ONE);
+  paint(two, PAINT_TWO);
+
+  vector<uint32_t> found, parents;
+  while (active > 0){
+    uint32_t position = queue.top().second;
+    queue.pop();
+    uint8_t& current = flags[position];
+    current &= ~PAINT_QUEUED;
+    uint8_t carried = current & (PAINT_ONE | PAINT_TWO | PAINT_STALE);
+    if (!(carried & PAINT_STALE)) active--;
+    if (carried == (PAINT_ONE | PAINT_TWO)){
+      if (!(current & PAINT_RESULT)){
+        current |= PAINT_RESULT;
+        found.push_back(position);
+      }
+      carried |= PAINT_STALE;//everything below is a worse candidate
+    }
+    graph.parents(position, parents);
+    for (uint32_t parent : parents){
+      auto it = flags.find(parent);
+      if (it != flags.end() && (it->second & carried) == carried) continue;
+      paint(parent, carried);
+    }
+  }
+  //parents always have a lower generation, so nothing popped later can
+  //reach a result and no redundancy pass is needed
+  return found;
+}
@@ -1,10 +1,24 @@
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <map>
 #include <vector>
+#include <string_view>
+#include <algorithm>
 
 using namespace std;
 
+//commits are stored in a binary encoding:
+//  "MGCM", u8 version, u8 hash bytes, u8 flags (1 = has a tree)
+//  varint parent count, raw parent ids, raw tree id if flagged
+//  varint length + timestamp, varint length + message
+//  varint file count, then sorted by name: varint length + name, raw blob id
+//lengths instead of separators keep any message or file name intact and the
+//parser only hands out views into the buffer it was given
+//commits written before it are "key:value" text lines and stay readable
+const char COMMIT_MAGIC[4] = {'M', 'G', 'C', 'M'};
+const uint8_t COMMIT_VERSION = 1;
+const uint8_t COMMIT_HAS_TREE = 1;
 
 //a method that returns current time as a string
 string getCurrentTime(){
@@ -16,54 +30,151 @@ string getCurrentTime(){
 }
 
 //the hash function to be used for ID's of commits and blobs 
+//the engine (blake3 or the legacy djb2) follows the repository format
 string generateHash(const std::string& data) {
-  unsigned long hash = 5381; // djb2 hash constant
-  for (char c : data) {
-      hash = ((hash << 5) + hash) + static_cast<unsigned char>(c); // hash * 33 + c
-  }
+  return hashWith(activeHashAlgorithm, data.data(), data.size());
+}
+
+//the id of a tree or commit: its type and size are hashed in front of the
+//content, so it can't be the id of a file that happens to hold the same bytes
+string generateHash(const string& type, const std::string& data) {
+  return generateHash(type + " " + to_string(data.size()) + '\0' + data);
+}
 
-  std::stringstream ss;
-  ss << std::hex << std::setw(16) << std::setfill('0') << hash;
-  return ss.str();
+//hashes a mapped file window by window
+string generateHash(const MappedFile& file) {
+  TraceScope scope("hash file");
+  unique_ptr<ContentHasher> hasher = makeHasher(activeHashAlgorithm);
+  file.forEachWindow([&](const char* data, size_t size){
+    hasher->update(data, size);
+    return true;
+  });
+  return hasher->hexDigest();
+}
+
+//hashes a file straight from its mapped view, returns "" if it can't be opened
+string generateFileHash(const string& path) {
+  MappedFile file(path);
+  if (!file.ok()) return "";
+  return generateHash(file);
 }
 
 struct CommitNode {
     string commitHash;
     string timestamp;
-    string parent;
+    vector<string> parents;//first parent first, merges record every merged head
     string message;
+    string treeHash; //root tree, empty for commits that list their files inline
     unordered_map<string, string> fileblobs; //filename -> blob hash
     
     CommitNode(){
       this -> timestamp = "";
       this -> message = "";
-      this -> parent = "";
       this -> commitHash = "";
     }
     
     CommitNode(const string& message, const string& parent) {
       this -> timestamp = getCurrentTime();
       this -> message = message;
-      this -> parent = parent;
+      if (!parent.empty()) this -> parents.push_back(parent);
+    }
+
+    string firstParent() const {
+      return parents.empty() ? "" : parents[0];
     }
     
+    //every field is hashed behind its length, so no message or file name
+    //can pass for the fields that follow it
     void computeAndSetHash() {
-      string contentToHash = "message:" + message + "\n" +
-                                  "timestamp:" + timestamp + "\n" +
-                                  "parent:" + parent + "\n" +
-                                  "files:";
-      bool first = true;
-      for (const auto& entry : fileblobs) {
-          if (!first) contentToHash += ",";
-          contentToHash += entry.first + "=" + entry.second;
-          first = false;
+      string contentToHash;
+      auto field = [&](const string& value) {
+          putVarint(contentToHash, value.size());
+          contentToHash += value;
+      };
+      field(message);
+      field(timestamp);
+      putVarint(contentToHash, parents.size());
+      for (const string& parent : parents) field(parent);
+      if (!treeHash.empty()) {
+          //the tree id already covers every file
+          contentToHash.push_back('T');
+          field(treeHash);
+      } else {
+          contentToHash.push_back('F');
+          //sorted so the same snapshot always gives the same id
+          map<string, string> sortedBlobs(fileblobs.begin(), fileblobs.end());
+          putVarint(contentToHash, sortedBlobs.size());
+          for (const auto& entry : sortedBlobs) {
+              field(entry.first);
+              field(entry.second);
+          }
       }
-      contentToHash += "\n";
-      this->commitHash = generateHash(contentToHash);
+      this->commitHash = generateHash("commit", contentToHash);
   }
     
 };
 
+//a binary commit parsed in place, every view points into the parsed buffer
+struct CommitView {
+  uint8_t hashBytes = 0;
+  string_view parents;//raw ids back to back, first parent first
+  string_view tree;//raw id, empty for commits that list their files
+  string_view timestamp;
+  string_view message;
+  uint64_t fileCount = 0;
+  string_view files;//fileCount entries of varint length, name, raw blob id
+
+  size_t parentCount() const { return hashBytes ? parents.size() / hashBytes : 0; }
+  string_view parent(size_t i) const { return parents.substr(i * hashBytes, hashBytes); }
+};
+
+bool isBinaryCommit(const char* data, size_t size){
+  return size >= 4 && memcmp(data, COMMIT_MAGIC, 4) == 0;
+}
+
+bool parseCommitView(const char* data, size_t size, CommitView& view){
+  if (!isBinaryCommit(data, size)) return false;
+  ByteReader reader(data + 4, size - 4);
+  if (reader.u8() != COMMIT_VERSION) return false;
+  view.hashBytes = reader.u8();
+  uint8_t flags = reader.u8();
+  uint64_t parentCount = reader.varint();
+  if (!reader.ok() || view.hashBytes == 0 || parentCount > reader.remaining() / view.hashBytes) return false;
+  view.parents = string_view(reader.current(), parentCount * view.hashBytes);
+  reader.take(view.parents.size());
+  if (flags & COMMIT_HAS_TREE){
+    const char* tree = reader.take(view.hashBytes);
+    if (tree) view.tree = string_view(tree, view.hashBytes);
+  }
+  uint64_t length = reader.varint();
+  const char* timestamp = reader.take(length);
+  if (timestamp) view.timestamp = string_view(timestamp, length);
+  length = reader.varint();
+  const char* message = reader.take(length);
+  if (message) view.message = string_view(message, length);
+  view.fileCount = reader.varint();
+  view.files = string_view(reader.current(), reader.remaining());
+  return reader.ok();
+}
+
+//calls visit(name, raw blob id) for every file of a view, false if the list is damaged
+template <typename Visitor>
+bool forEachCommitFile(const CommitView& view, Visitor visit){
+  ByteReader reader(view.files.data(), view.files.size());
+  for (uint64_t i = 0; i < view.fileCount; ++i){
+    uint64_t length = reader.varint();
+    const char* name = reader.take(length);
+    const char* blob = reader.take(view.hashBytes);
+    if (!name || !blob) return false;
+    visit(string_view(name, length), string_view(blob, view.hashBytes));
+  }
+  return reader.ok();
+}
+
+string hexId(const string_view& raw){
+  return toHex(reinterpret_cast<const uint8_t*>(raw.data()), raw.size());
+}
+
 class CommitList {
   private:
     CommitNode* head;
@@ -76,18 +187,66 @@ class CommitList {
         if (!head) {
             head = newNode;
         } else {
-            newNode->parent = head->commitHash;
+            newNode->parents = {head->commitHash};
             head = newNode;
       }
     }
     
     
+    //the binary encoding, or the text one for ids it can't hold (legacy
+    //repositories whose ids aren't hex)
     string commitData(CommitNode& cmt) {
+      TraceScope scope("encode commit");
+      string binaryTree = hexToBytes(cmt.treeHash);
+      size_t hashBytes = 0;
+      vector<string> ids;
+      bool binary = true;
+      auto addId = [&](const string& hex) {
+        string raw = hexToBytes(hex);
+        if (hashBytes == 0) hashBytes = raw.size();
+        binary = binary && !raw.empty() && raw.size() == hashBytes;
+        ids.push_back(raw);
+      };
+      for (const string& parent : cmt.parents) addId(parent);
+      if (!cmt.treeHash.empty()) addId(cmt.treeHash);
+      //the tree id already covers every file, like the text encoding only
+      //commits without one list them
+      vector<pair<string, string>> files;
+      if (cmt.treeHash.empty()) files.assign(cmt.fileblobs.begin(), cmt.fileblobs.end());
+      sort(files.begin(), files.end());
+      for (const auto& file : files) addId(file.second);
+      if (binary && hashBytes > 0) {
+        string out(COMMIT_MAGIC, 4);
+        out.push_back(char(COMMIT_VERSION));
+        out.push_back(char(hashBytes));
+        out.push_back(char(cmt.treeHash.empty() ? 0 : COMMIT_HAS_TREE));
+        putVarint(out, cmt.parents.size());
+        size_t next = 0;
+        for (size_t i = 0; i < cmt.parents.size(); ++i) out += ids[next++];
+        if (!cmt.treeHash.empty()) out += ids[next++];
+        putVarint(out, cmt.timestamp.size());
+        out += cmt.timestamp;
+        putVarint(out, cmt.message.size());
+        out += cmt.message;
+        putVarint(out, files.size());
+        for (const auto& file : files) {
+          putVarint(out, file.first.size());
+          out += file.first;
+          out += ids[next++];
+        }
+        return out;
+      }
+
       stringstream ss;
       ss << "commitHash:" <<cmt.commitHash <<"\n";
       ss << "message:" <<cmt.message <<"\n";
       ss << "timestamp:" <<cmt.timestamp <<"\n";
-      ss << "parent:" <<cmt.parent <<"\n";
+      ss << "parent:" <<cmt.firstParent() <<"\n";
+      for (size_t i = 1; i < cmt.parents.size(); ++i) ss << "parent:" <<cmt.parents[i] <<"\n";
+      if (!cmt.treeHash.empty()) {
+        ss << "tree:" <<cmt.treeHash <<"\n";
+        return ss.str();
+      }
       ss << "files:";
       bool first = true;
 
@@ -100,8 +259,49 @@ class CommitList {
       return ss.str();
     }
     
-    CommitNode deserialize(const string& data) {
+    //the header of a stored commit as a view into data, for walks that need
+    //no files: binary commits are parsed in place, text ones are re-encoded
+    //into data first; false when the commit is damaged
+    bool headerView(string& data, const string& id, CommitView& view) {
+      view = CommitView();
+      if (isBinaryCommit(data.data(), data.size())) return parseCommitView(data.data(), data.size(), view);
+      CommitNode c = deserialize(data, id);
+      if (c.commitHash.empty()) return false;
+      c.fileblobs.clear();
+      data = commitData(c);
+      if (isBinaryCommit(data.data(), data.size())) return parseCommitView(data.data(), data.size(), view);
+      if (!c.parents.empty() || !c.treeHash.empty()) return false;//ids that aren't hex
+      //a root commit without a tree has no ids to encode, only its text
+      data = c.timestamp + c.message;
+      view.timestamp = string_view(data.data(), c.timestamp.size());
+      view.message = string_view(data.data() + c.timestamp.size(), c.message.size());
+      return true;
+    }
+
+    //id is the object id the data was read under, binary commits don't repeat it
+    CommitNode deserialize(const string& data, const string& id = "") {
+      TraceScope scope("parse commit");
+      traceCount(TRACE_COMMITS_PARSED);
       CommitNode c;
+      CommitView view;
+      if (isBinaryCommit(data.data(), data.size())) {
+        if (!parseCommitView(data.data(), data.size(), view)) return c;
+        c.commitHash = id;
+        c.timestamp = string(view.timestamp);
+        c.message = string(view.message);
+        for (size_t i = 0; i < view.parentCount(); ++i) c.parents.push_back(hexId(view.parent(i)));
+        //files come from the tree when there is one, so a header read of
+        //such a commit never walks the list
+        if (!view.tree.empty()) {
+          c.treeHash = hexId(view.tree);
+          return c;
+        }
+        bool filesOk = forEachCommitFile(view, [&](const string_view& name, const string_view& blob) {
+          c.fileblobs[string(name)] = hexId(blob);
+        });
+        if (!filesOk) c.commitHash = "";
+        return c;
+      }
       stringstream ss(data);
       string line;
       while (getline(ss, line)) {
@@ -113,18 +313,28 @@ class CommitList {
 
           if (key == "commitHash") c.commitHash = value;
           else if (key == "message") c.message = value;
+          else if (key == "tree") c.treeHash = value;
           else if (key == "timestamp") c.timestamp = value;
-          else if (key == "parent") c.parent = value;
+          else if (key == "parent") {
+              if (!value.empty()) c.parents.push_back(value);
+          }
           else if (key == "files") {
-              stringstream filesSs(value);
-              string fileEntry;
-              while (getline(filesSs, fileEntry, ',')) {
-                  size_t eqPos = fileEntry.find('=');
-                  if (eqPos != string::npos) {
-                      string filename = fileEntry.substr(0, eqPos);
-                      string blobHash = fileEntry.substr(eqPos + 1);
-                      c.fileblobs[filename] = blobHash;
+              //entries are name=id joined by ',', names may hold either
+              //character, so an entry ends at the '=' followed by an id
+              //that runs up to the next ',' or the end
+              size_t start = 0, eqPos = value.find('=');
+              while (eqPos != string::npos) {
+                  size_t end = value.find(',', eqPos);
+                  if (end == string::npos) end = value.size();
+                  string blobHash = value.substr(eqPos + 1, end - eqPos - 1);
+                  if (blobHash.empty() || blobHash.find_first_not_of("0123456789abcdef") != string::npos) {
+                      eqPos = value.find('=', eqPos + 1);
+                      continue;
                   }
+                  string filename = normalizePath(value.substr(start, eqPos - start));//older commits stored './name
+                  c.fileblobs[filename] = blobHash;
+                  start = end + 1;
+                  eqPos = value.find('=', start);
               }
           }
       }
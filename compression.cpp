@@ -0,0 +1,178 @@
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+//this file includes the LZ4 block codec used for stored objects
+//the output is the standard LZ4 block format, written here so the build
+//has no external dependency; the level trades speed for ratio:
+//  1    - one candidate per position, skips ahead faster in incompressible data
+//  2..9 - follows a hash chain of up to 2^level earlier positions per match
+
+const size_t LZ4_MIN_MATCH = 4;
+const size_t LZ4_LAST_LITERALS = 5;//the block must end with this many literals
+const size_t LZ4_MATCH_SAFE = 12;//no match may start in the last 12 bytes
+const size_t LZ4_MAX_OFFSET = 65535;
+const int LZ4_HASH_BITS = 16;
+
+static inline uint32_t lz4Read32(const char* p){
+  uint32_t value;
+  memcpy(&value, p, 4);
+  return value;
+}
+
+static inline uint32_t lz4HashPosition(const char* p){
+  return (lz4Read32(p) * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+//number of equal bytes at a and b, compared 8 at a time, b stops at limit
+static inline size_t lz4MatchLength(const char* a, const char* b, const char* limit){
+  const char* start = b;
+  while (b + 8 <= limit){
+    uint64_t x, y;
+    memcpy(&x, a, 8);
+    memcpy(&y, b, 8);
+    if (x != y) return (b - start) + (__builtin_ctzll(x ^ y) >> 3);
+    a += 8;
+    b += 8;
+  }
+  while (b < limit && *a == *b){
+    a++;
+    b++;
+  }
+  return b - start;
+}
+
+static void lz4PutLength(string& out, size_t length){
+  while (length >= 255){
+    out.push_back(char(255));
+    length -= 255;
+  }
+  out.push_back(char(length));
+}
+
+static void lz4EmitSequence(string& out, const char* literals, size_t literalLength, size_t offset, size_t matchLength){
+  size_t matchCode = matchLength - LZ4_MIN_MATCH;
+  uint8_t token = uint8_t((min(literalLength, size_t(15)) << 4) | min(matchCode, size_t(15)));
+  out.push_back(char(token));
+  if (literalLength >= 15) lz4PutLength(out, literalLength - 15);
+  out.append(literals, literalLength);
+  out.push_back(char(offset & 0xff));
+  out.push_back(char(offset >> 8));
+  if (matchCode >= 15) lz4PutLength(out, matchCode - 15);
+}
+
+//appends the compressed form of src to out
+void lz4Compress(const char* src, size_t size, int level, string& out){
+  size_t anchor = 0;
+  if (size > LZ4_MATCH_SAFE){
+    vector<int32_t> head(size_t(1) << LZ4_HASH_BITS, -1);
+    vector<int32_t> chain(level > 1 ? LZ4_MAX_OFFSET + 1 : 0, -1);
+    size_t maxAttempts = level > 1 ? (size_t(1) << min(level, 12)) : 1;
+    size_t matchStartLimit = size - LZ4_MATCH_SAFE;
+    size_t matchEndLimit = size - LZ4_LAST_LITERALS;
+
+    auto insert = [&](size_t pos){
+      uint32_t h = lz4HashPosition(src + pos);
+      if (!chain.empty()) chain[pos & LZ4_MAX_OFFSET] = head[h];
+      head[h] = int32_t(pos);
+    };
+
+    size_t pos = 0;
+    while (pos < matchStartLimit){
+      size_t bestLength = 0, bestPos = 0;
+      int32_t candidate = head[lz4HashPosition(src + pos)];
+      for (size_t attempt = 0; attempt < maxAttempts && candidate >= 0; ++attempt){
+        size_t distance = pos - size_t(candidate);
+        if (distance == 0 || distance > LZ4_MAX_OFFSET) break;
+        if (lz4Read32(src + candidate) == lz4Read32(src + pos)){
+          size_t length = lz4MatchLength(src + candidate + LZ4_MIN_MATCH, src + pos + LZ4_MIN_MATCH, src + matchEndLimit) + LZ4_MIN_MATCH;
+          if (length > bestLength){
+            bestLength = length;
+            bestPos = candidate;
+          }
+        }
+        if (chain.empty()) break;
+        int32_t next = chain[candidate & LZ4_MAX_OFFSET];
+        if (next >= candidate) break;//slot was reused by a newer position
+        candidate = next;
+      }
+      insert(pos);
+
+      if (bestLength < LZ4_MIN_MATCH){
+        //level 1 speeds up through data that keeps failing to match
+        pos += level > 1 ? 1 : 1 + ((pos - anchor) >> 6);
+        continue;
+      }
+      while (pos > anchor && bestPos > 0 && src[pos - 1] == src[bestPos - 1]){
+        pos--;
+        bestPos--;
+        bestLength++;
+      }
+      lz4EmitSequence(out, src + anchor, pos - anchor, pos - bestPos, bestLength);
+      size_t matchEnd = pos + bestLength;
+      if (level > 1){
+        for (size_t p = pos + 1; p < matchEnd && p < matchStartLimit; ++p) insert(p);
+      } else if (matchEnd - 2 < matchStartLimit){
+        insert(matchEnd - 2);
+      }
+      pos = matchEnd;
+      anchor = pos;
+    }
+  }
+
+  //the remaining bytes are literals only
+  size_t literalLength = size - anchor;
+  out.push_back(char(min(literalLength, size_t(15)) << 4));
+  if (literalLength >= 15) lz4PutLength(out, literalLength - 15);
+  out.append(src + anchor, literalLength);
+}
+
+//decodes a block that expands to exactly dstSize bytes, false on corrupt input
+bool lz4Decompress(const char* src, size_t srcSize, char* dst, size_t dstSize){
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+  const uint8_t* inEnd = in + srcSize;
+  size_t outPos = 0;
+
+  auto readLength = [&](size_t length, bool& ok) -> size_t {
+    if (length != 15) return length;
+    uint8_t extra;
+    do {
+      if (in >= inEnd){
+        ok = false;
+        return 0;
+      }
+      extra = *in++;
+      length += extra;
+    } while (extra == 255);
+    return length;
+  };
+
+  while (in < inEnd){
+    uint8_t token = *in++;
+    bool ok = true;
+    size_t literalLength = readLength(token >> 4, ok);
+    if (!ok || size_t(inEnd - in) < literalLength || dstSize - outPos < literalLength) return false;
+    memcpy(dst + outPos, in, literalLength);
+    in += literalLength;
+    outPos += literalLength;
+    if (in == inEnd) break;//the last sequence has no match
+
+    if (inEnd - in < 2) return false;
+    size_t offset = size_t(in[0]) | (size_t(in[1]) << 8);
+    in += 2;
+    size_t matchLength = readLength(token & 15, ok) + LZ4_MIN_MATCH;
+    if (!ok || offset == 0 || offset > outPos || dstSize - outPos < matchLength) return false;
+    char* out = dst + outPos;
+    const char* match = out - offset;
+    if (offset >= matchLength){
+      memcpy(out, match, matchLength);
+    } else {
+      for (size_t i = 0; i < matchLength; ++i) out[i] = match[i];//overlapping run
+    }
+    outPos += matchLength;
+  }
+  return outPos == dstSize;
+}
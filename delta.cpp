@@ -0,0 +1,97 @@
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+//this file includes the binary delta format used inside packs
+//a delta rebuilds a target from a base with two instructions, each
+//starting with varint(length << 1 | isCopy):
+//  copy   - followed by varint(offset), copies length bytes of the base
+//  insert - followed by length literal bytes
+//the encoder indexes the base in DELTA_BLOCK sized blocks and extends
+//every block hit in both directions
+
+const size_t DELTA_BLOCK = 16;
+const int DELTA_HASH_BITS = 18;
+
+static inline uint32_t deltaHashBlock(const char* p){
+  uint64_t a, b;
+  memcpy(&a, p, 8);
+  memcpy(&b, p + 8, 8);
+  uint64_t mixed = (a * 0x9E3779B97F4A7C15ull) ^ (b * 0xC2B2AE3D27D4EB4Full);
+  return uint32_t(mixed >> (64 - DELTA_HASH_BITS));
+}
+
+static void deltaInsert(string& out, const char* data, size_t size){
+  if (size == 0) return;
+  putVarint(out, uint64_t(size) << 1);
+  out.append(data, size);
+}
+
+//appends the delta turning base into target to out, gives up and returns
+//false once the delta grows past maxSize
+bool createDelta(const char* base, size_t baseSize, const char* target, size_t targetSize, size_t maxSize, string& out){
+  size_t start = out.size();
+  if (baseSize < DELTA_BLOCK || targetSize < DELTA_BLOCK){
+    deltaInsert(out, target, targetSize);
+    return out.size() - start <= maxSize;
+  }
+
+  //last block of the base for every hash, later blocks win
+  vector<int64_t> table(size_t(1) << DELTA_HASH_BITS, -1);
+  for (size_t pos = 0; pos + DELTA_BLOCK <= baseSize; pos += DELTA_BLOCK){
+    table[deltaHashBlock(base + pos)] = int64_t(pos);
+  }
+
+  size_t anchor = 0;//start of the pending literals
+  size_t pos = 0;
+  while (pos + DELTA_BLOCK <= targetSize){
+    int64_t candidate = table[deltaHashBlock(target + pos)];
+    if (candidate < 0 || memcmp(base + candidate, target + pos, DELTA_BLOCK) != 0){
+      pos++;
+      continue;
+    }
+    size_t baseStart = size_t(candidate), targetStart = pos;
+    //grow backwards into the pending literals
+    while (targetStart > anchor && baseStart > 0 && base[baseStart - 1] == target[targetStart - 1]){
+      baseStart--;
+      targetStart--;
+    }
+    size_t length = (pos - targetStart) + DELTA_BLOCK;
+    length += lz4MatchLength(base + baseStart + length, target + targetStart + length,
+                             target + targetStart + min(targetSize - targetStart, baseSize - baseStart));
+
+    deltaInsert(out, target + anchor, targetStart - anchor);
+    putVarint(out, (uint64_t(length) << 1) | 1);
+    putVarint(out, baseStart);
+    if (out.size() - start > maxSize) return false;
+    pos = targetStart + length;
+    anchor = pos;
+  }
+  deltaInsert(out, target + anchor, targetSize - anchor);
+  return out.size() - start <= maxSize;
+}
+
+//rebuilds the target into out, which must be targetSize long, false on a corrupt delta
+bool applyDelta(const char* base, size_t baseSize, const char* delta, size_t deltaSize, char* out, size_t targetSize){
+  ByteReader reader(delta, deltaSize);
+  size_t written = 0;
+  while (!reader.atEnd()){
+    uint64_t op = reader.varint();
+    uint64_t length = op >> 1;
+    if (!reader.ok() || length > targetSize - written) return false;
+    if (op & 1){
+      uint64_t offset = reader.varint();
+      if (!reader.ok() || offset > baseSize || length > baseSize - offset) return false;
+      memcpy(out + written, base + offset, length);
+    } else {
+      const char* literals = reader.take(length);
+      if (!literals) return false;
+      memcpy(out + written, literals, length);
+    }
+    written += length;
+  }
+  return written == targetSize;
+}
@@ -0,0 +1,304 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <array>
+
+using namespace std;
+
+//this file includes the line diff used by 'minigit diff'
+//lines are interned to integer ids so comparisons are a single int compare;
+//a region is split on its rarest common line (the histogram heuristic, which
+//keeps unique lines such as function headers aligned) and regions without a
+//usable anchor go to Myers' O(ND) algorithm in its linear space divide and
+//conquer form (middle snake), so memory stays proportional to the input
+//the result marks which lines of each side changed, the unified output
+//groups those marks into hunks with context
+
+const size_t DIFF_CONTEXT = 3;
+//lines occurring more often than this in a region are not used as anchors
+const size_t DIFF_MAX_OCCURRENCES = 64;
+//files with a NUL byte in their first DIFF_BINARY_PROBE bytes count as binary
+const size_t DIFF_BINARY_PROBE = 8000;
+
+struct DiffInput {
+  vector<string_view> lines;//each line with its '\n', if any
+  vector<uint32_t> ids;
+};
+
+//gives equal lines the same id across every text split with it
+class LineTable {
+  private:
+    unordered_map<string_view, uint32_t> ids;
+
+  public:
+    void split(const string_view& text, DiffInput& out){
+      size_t start = 0;
+      while (start < text.size()){
+        size_t end = text.find('\n', start);
+        end = end == string_view::npos ? text.size() : end + 1;
+        string_view line = text.substr(start, end - start);
+        out.lines.push_back(line);
+        out.ids.push_back(ids.emplace(line, uint32_t(ids.size())).first->second);
+        start = end;
+      }
+    }
+};
+
+class LineDiff {
+  private:
+    const vector<uint32_t>& a;
+    const vector<uint32_t>& b;
+    vector<int64_t> forward, backward;//reused by every middle snake search
+    //histogram tables indexed by line id, empty again after every region
+    vector<uint32_t> count;
+    vector<int64_t> first, next;
+
+    //finds a point on an optimal edit path through a[xoff, xlim) and b[yoff, ylim)
+    //where both sides are non-empty and their first and last lines differ
+    void middleSnake(int64_t xoff, int64_t xlim, int64_t yoff, int64_t ylim, int64_t& xmid, int64_t& ymid){
+      int64_t n = xlim - xoff, m = ylim - yoff;
+      int64_t delta = n - m;
+      bool odd = delta & 1;
+      int64_t maxD = (n + m + 1) / 2;
+      int64_t offset = maxD + 1;
+      //furthest x reached on every diagonal k = x - y, -1 where none is
+      forward.assign(2 * offset + 1, -1);
+      backward.assign(2 * offset + 1, -1);
+      for (int64_t d = 0; d <= maxD; ++d){
+        for (int64_t k = -d; k <= d; k += 2){
+          if (k < -m || k > n) continue;
+          int64_t x = furthest(forward, offset, k, d, n, m);
+          forward[offset + k] = x;
+          if (x < 0) continue;
+          int64_t y = x - k;
+          while (x < n && y < m && a[xoff + x] == b[yoff + y]){
+            x++;
+            y++;
+          }
+          forward[offset + k] = x;
+          int64_t reverseK = delta - k;
+          if (odd && reverseK >= -(d - 1) && reverseK <= d - 1 &&
+              backward[offset + reverseK] >= 0 && x + backward[offset + reverseK] >= n) {
+            xmid = xoff + x;
+            ymid = yoff + y;
+            return;
+          }
+        }
+        //the same search from the end of both sides, on reversed sequences
+        for (int64_t k = -d; k <= d; k += 2){
+          if (k < -m || k > n) continue;
+          int64_t x = furthest(backward, offset, k, d, n, m);
+          backward[offset + k] = x;
+          if (x < 0) continue;
+          int64_t y = x - k;
+          while (x < n && y < m && a[xlim - 1 - x] == b[ylim - 1 - y]){
+            x++;
+            y++;
+          }
+          backward[offset + k] = x;
+          int64_t forwardK = delta - k;
+          if (!odd && forwardK >= -d && forwardK <= d &&
+              forward[offset + forwardK] >= 0 && x + forward[offset + forwardK] >= n) {
+            xmid = xlim - x;
+            ymid = ylim - y;
+            return;
+          }
+        }
+      }
+      xmid = xoff;//not reached for valid input
+      ymid = ylim;
+    }
+
+    //the furthest x on diagonal k after d edits, from the d - 1 paths on
+    //the neighbouring diagonals; paths leaving the n x m grid are dropped
+    static int64_t furthest(const vector<int64_t>& v, int64_t offset, int64_t k, int64_t d, int64_t n, int64_t m){
+      if (d == 0) return 0;
+      int64_t x = -1;
+      if (k + 1 <= d - 1 && v[offset + k + 1] >= 0 && v[offset + k + 1] - k <= m) x = v[offset + k + 1];
+      if (k - 1 >= -(d - 1) && v[offset + k - 1] >= 0 && v[offset + k - 1] + 1 <= n) x = max(x, v[offset + k - 1] + 1);
+      return x;
+    }
+
+    void myers(int64_t xoff, int64_t xlim, int64_t yoff, int64_t ylim){
+      while (xoff < xlim && yoff < ylim && a[xoff] == b[yoff]){
+        xoff++;
+        yoff++;
+      }
+      while (xlim > xoff && ylim > yoff && a[xlim - 1] == b[ylim - 1]){
+        xlim--;
+        ylim--;
+      }
+      if (xoff == xlim){
+        for (int64_t y = yoff; y < ylim; ++y) inserted[y] = 1;
+      } else if (yoff == ylim){
+        for (int64_t x = xoff; x < xlim; ++x) deleted[x] = 1;
+      } else {
+        int64_t xmid, ymid;
+        middleSnake(xoff, xlim, yoff, ylim, xmid, ymid);
+        myers(xoff, xmid, yoff, ymid);
+        myers(xmid, xlim, ymid, ylim);
+      }
+    }
+
+    //splits regions on the longest run of equal lines that starts with
+    //their rarest common line, Myers for regions without a rare enough line;
+    //equally good runs are split nearest the middle so an evenly edited file
+    //divides in halves instead of one edit at a time
+    void histogram(int64_t xoff, int64_t xlim, int64_t yoff, int64_t ylim){
+      vector<array<int64_t, 4>> regions = {{xoff, xlim, yoff, ylim}};
+      while (!regions.empty()){
+        xoff = regions.back()[0];
+        xlim = regions.back()[1];
+        yoff = regions.back()[2];
+        ylim = regions.back()[3];
+        regions.pop_back();
+        while (xoff < xlim && yoff < ylim && a[xoff] == b[yoff]){
+          xoff++;
+          yoff++;
+        }
+        while (xlim > xoff && ylim > yoff && a[xlim - 1] == b[ylim - 1]){
+          xlim--;
+          ylim--;
+        }
+        if (xoff == xlim || yoff == ylim){
+          myers(xoff, xlim, yoff, ylim);
+          continue;
+        }
+
+        //occurrences of every line of a in the region, chained through next
+        for (int64_t x = xlim - 1; x >= xoff; --x){
+          next[x] = first[a[x]];
+          first[a[x]] = x;
+          count[a[x]]++;
+        }
+        uint32_t bestCount = DIFF_MAX_OCCURRENCES;
+        int64_t bestX = -1, bestY = -1, bestLength = 0, bestDistance = 0;
+        int64_t middle = yoff + (ylim - yoff) / 2;
+        for (int64_t y = yoff; y < ylim; ++y){
+          uint32_t occurrences = b[y] < count.size() ? count[b[y]] : 0;
+          if (occurrences == 0 || occurrences > bestCount) continue;
+          for (int64_t x = first[b[y]]; x >= 0; x = next[x]){
+            //only the start of a run of equal lines is worth measuring
+            if (x > xoff && y > yoff && a[x - 1] == b[y - 1]) continue;
+            int64_t length = 0;
+            while (x + length < xlim && y + length < ylim && a[x + length] == b[y + length]) length++;
+            int64_t distance = abs(y + length / 2 - middle);
+            if (occurrences < bestCount || length > bestLength ||
+                (length == bestLength && distance < bestDistance)) {
+              bestCount = occurrences;
+              bestX = x;
+              bestY = y;
+              bestLength = length;
+              bestDistance = distance;
+            }
+          }
+        }
+        for (int64_t x = xoff; x < xlim; ++x){
+          first[a[x]] = -1;
+          count[a[x]] = 0;
+        }
+        if (bestX < 0){
+          myers(xoff, xlim, yoff, ylim);
+          continue;
+        }
+        regions.push_back({xoff, bestX, yoff, bestY});
+        regions.push_back({bestX + bestLength, xlim, bestY + bestLength, ylim});
+      }
+    }
+
+  public:
+    vector<char> deleted;//per line of a
+    vector<char> inserted;//per line of b
+
+    LineDiff(const vector<uint32_t>& left, const vector<uint32_t>& right)
+        : a(left), b(right), deleted(left.size(), 0), inserted(right.size(), 0){}
+
+    void run(bool useHistogram = true){
+      if (useHistogram){
+        uint32_t ids = a.empty() ? 0 : *max_element(a.begin(), a.end()) + 1;
+        count.assign(ids, 0);
+        first.assign(ids, -1);
+        next.assign(a.size(), -1);
+        histogram(0, a.size(), 0, b.size());
+      } else {
+        myers(0, a.size(), 0, b.size());
+      }
+    }
+};
+
+bool looksBinary(const string_view& text){
+  return text.substr(0, DIFF_BINARY_PROBE).find('\0') != string_view::npos;
+}
+
+//appends a unified diff of two texts to out, returns false when they are equal
+bool unifiedDiff(const string_view& oldText, const string_view& newText,
+                 const string& oldName, const string& newName, string& out){
+  if (oldText == newText) return false;
+  if (looksBinary(oldText) || looksBinary(newText)){
+    out += "Binary files " + oldName + " and " + newName + " differ\n";
+    return true;
+  }
+  DiffInput left, right;
+  LineTable table;
+  table.split(oldText, left);
+  table.split(newText, right);
+  LineDiff diff(left.ids, right.ids);
+  diff.run();
+
+  //the edit script: ' ' keeps a line of both, '-' drops one of a, '+' adds one of b
+  struct Edit {
+    char op;
+    size_t oldLine, newLine;
+  };
+  vector<Edit> edits;
+  size_t i = 0, j = 0;
+  while (i < left.lines.size() || j < right.lines.size()){
+    if (i < left.lines.size() && diff.deleted[i]) edits.push_back({'-', i++, j});
+    else if (j < right.lines.size() && diff.inserted[j]) edits.push_back({'+', i, j++});
+    else edits.push_back({' ', i++, j++});
+  }
+
+  out += "--- " + oldName + "\n+++ " + newName + "\n";
+  auto appendLine = [&](char op, const string_view& line){
+    out.push_back(op);
+    out.append(line.data(), line.size());
+    if (line.empty() || line.back() != '\n') out += "\n\\ No newline at end of file\n";
+  };
+  size_t e = 0;
+  while (e < edits.size()){
+    if (edits[e].op == ' '){
+      e++;
+      continue;
+    }
+    //a hunk runs until a gap of more than twice the context
+    size_t start = e >= DIFF_CONTEXT ? e - DIFF_CONTEXT : 0;
+    size_t end = e, unchanged = 0;
+    for (size_t k = e; k < edits.size(); ++k){
+      if (edits[k].op != ' '){
+        end = k + 1;
+        unchanged = 0;
+      } else if (++unchanged > 2 * DIFF_CONTEXT){
+        break;
+      }
+    }
+    end = min(edits.size(), end + DIFF_CONTEXT);
+    size_t oldCount = 0, newCount = 0;
+    for (size_t k = start; k < end; ++k){
+      if (edits[k].op != '+') oldCount++;
+      if (edits[k].op != '-') newCount++;
+    }
+    //unified diff numbers lines from 1 and uses the line before for empty ranges
+    size_t oldStart = edits[start].oldLine + (oldCount ? 1 : 0);
+    size_t newStart = edits[start].newLine + (newCount ? 1 : 0);
+    out += "@@ -" + to_string(oldStart) + "," + to_string(oldCount) +
+           " +" + to_string(newStart) + "," + to_string(newCount) + " @@\n";
+    for (size_t k = start; k < end; ++k){
+      const Edit& edit = edits[k];
+      appendLine(edit.op, edit.op == '+' ? right.lines[edit.newLine] : left.lines[edit.oldLine]);
+    }
+    e = end;
+  }
+  return true;
+}
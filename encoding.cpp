@@ -0,0 +1,103 @@
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+//this file includes the little-endian helpers used by the binary on-disk formats
+
+void putU16(string& out, uint16_t value){
+  for (int i = 0; i < 2; ++i) out.push_back(char((value >> (8 * i)) & 0xff));
+}
+
+void putU32(string& out, uint32_t value){
+  for (int i = 0; i < 4; ++i) out.push_back(char((value >> (8 * i)) & 0xff));
+}
+
+void putU64(string& out, uint64_t value){
+  for (int i = 0; i < 8; ++i) out.push_back(char((value >> (8 * i)) & 0xff));
+}
+
+//7 bits per byte, high bit set on every byte but the last
+void putVarint(string& out, uint64_t value){
+  while (value >= 0x80){
+    out.push_back(char((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(char(value));
+}
+
+uint16_t getU16(const char* p){
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+  return uint16_t(b[0] | (b[1] << 8));
+}
+
+uint32_t getU32(const char* p){
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+  return uint32_t(b[0]) | (uint32_t(b[1]) << 8) | (uint32_t(b[2]) << 16) | (uint32_t(b[3]) << 24);
+}
+
+uint64_t getU64(const char* p){
+  return uint64_t(getU32(p)) | (uint64_t(getU32(p + 4)) << 32);
+}
+
+//turns a hex id into raw bytes, returns "" for malformed input
+string hexToBytes(const string& hex){
+  if (hex.size() % 2 != 0) return "";
+  string bytes(hex.size() / 2, '\0');
+  for (size_t i = 0; i < hex.size(); ++i){
+    char c = hex[i];
+    int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+    if (digit < 0) return "";
+    bytes[i / 2] = char((bytes[i / 2] << 4) | digit);
+  }
+  return bytes;
+}
+
+//reads sequentially from a buffer and remembers if it ran past the end
+class ByteReader {
+  private:
+    const char* pos;
+    const char* end;
+    bool failed;
+
+  public:
+    ByteReader(const char* data, size_t size) : pos(data), end(data + size), failed(false){}
+
+    bool ok() const { return !failed; }
+    const char* current() const { return pos; }
+    bool atEnd() const { return pos == end; }
+    size_t remaining() const { return end - pos; }
+
+    const char* take(size_t count){
+      if (failed || remaining() < count){
+        failed = true;
+        return nullptr;
+      }
+      const char* start = pos;
+      pos += count;
+      return start;
+    }
+
+    uint8_t u8(){ const char* p = take(1); return p ? uint8_t(*p) : 0; }
+    uint16_t u16(){ const char* p = take(2); return p ? getU16(p) : 0; }
+    uint32_t u32(){ const char* p = take(4); return p ? getU32(p) : 0; }
+    uint64_t u64(){ const char* p = take(8); return p ? getU64(p) : 0; }
+
+    uint64_t varint(){
+      uint64_t value = 0;
+      for (int shift = 0; shift < 64; shift += 7){
+        const char* p = take(1);
+        if (!p) return 0;
+        value |= uint64_t(*p & 0x7f) << shift;
+        if ((*p & 0x80) == 0) return value;
+      }
+      failed = true;
+      return 0;
+    }
+
+    string bytes(size_t count){
+      const char* p = take(count);
+      return p ? string(p, count) : string();
+    }
+};
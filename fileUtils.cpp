@@ -2,6 +2,25 @@
 #include <fstream>
 #include <string>
 #include <filesystem>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#else
+#include <io.h>
+#endif
 
 using namespace std;
 
@@ -12,6 +31,43 @@ bool fileExists(const string& path){
   return filesystem::exists(path); 
   }
 
+//file metadata used to detect changes without reading the content
+struct FileStat {
+  uint64_t size = 0;
+  int64_t mtimeNs = 0;
+  int64_t ctimeNs = 0;
+  uint64_t inode = 0;
+  uint32_t mode = 0;
+};
+
+//fills info with the size, times, inode and mode of the file
+bool statFile(const string& path, FileStat& info){
+  struct stat st;
+  traceCount(TRACE_FILES_STATTED);
+  if (stat(path.c_str(), &st) != 0){
+    return false;
+  }
+  info.size = st.st_size;
+#if defined(__APPLE__)
+  info.mtimeNs = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+  info.ctimeNs = int64_t(st.st_ctimespec.tv_sec) * 1000000000 + st.st_ctimespec.tv_nsec;
+#elif defined(_WIN32)
+  info.mtimeNs = int64_t(st.st_mtime) * 1000000000;
+  info.ctimeNs = int64_t(st.st_ctime) * 1000000000;
+#else
+  info.mtimeNs = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  info.ctimeNs = int64_t(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+#endif
+  info.inode = st.st_ino;
+  info.mode = st.st_mode;
+  return true;
+}
+
+//turns './dir/../file' style paths into the form stored in the index
+string normalizePath(const string& path){
+  return filesystem::path(path).lexically_normal().generic_string();
+}
+
 //create file directory
 bool createDirectory(const string& path){
   error_code error;//to capture any error 
@@ -19,7 +75,8 @@ bool createDirectory(const string& path){
     return true;// if file already exists
     }
   //if file doesn't exist it create the directory
-  else if (filesystem::create_directories(path, error)){
+  //no error code means another thread created it first, which is fine too
+  else if (filesystem::create_directories(path, error) || !error){
           return true;//shows creating directory wasn's succesful
         } else {
             // if there is any error occur, it displays the error
@@ -35,23 +92,30 @@ string currentDir(){
 }
   
 //read the contents of selected file
+//the string is sized from the file length up front so the data is copied once
 string readFile(const string& path){
-  ifstream file(path);// opens the target file
+  ifstream file(path, ios::binary | ios::ate);// opens the target file at its end to learn the size
   if (!file.is_open()){
   //check if file is open/available and return empty string and displays the errormessage
     cout << "Error: Could not open file for reading: " << path << std::endl;
     return "";
   }
-  stringstream buffer;//creates string object as input/output object
-  buffer <<file.rdbuf();//retrieves the related stream buffer from the opened file
-  string content = buffer.str();//conversion of string data from a memory buffer
-  file.close();//closes the file
+  error_code ec;
+  if (!filesystem::is_regular_file(path, ec)) return "";//directories report a bogus size
+  streamoff size = file.tellg();
+  if (size <= 0) return "";
+  string content(size, '\0');
+  file.seekg(0);
+  file.read(&content[0], size);//reads straight into the result
+  content.resize(file.gcount());
+  traceCount(TRACE_FILES_READ);
+  traceCount(TRACE_BYTES_READ, content.size());
   return content;//return the file content
 }
 
 //creates a file with the provided content or changes the content of existing file
 bool writeFile(const string& path, const string& content){
-  ofstream file(path);//opens the file
+  ofstream file(path, ios::binary);//opens the file
   if (!file.is_open()){
     //displays the error message if file couldn't be opened
     cout <<"Error: Could not open file for writing: " <<path <<endl;
@@ -59,6 +123,8 @@ bool writeFile(const string& path, const string& content){
   }
   file <<content;//replaces the content to the file
   file.close();//closes the file
+  traceCount(TRACE_FILES_WRITTEN);
+  traceCount(TRACE_BYTES_WRITTEN, content.size());
   return true;//approves that the changes are made
 }
 
@@ -75,3 +141,490 @@ bool removeFile(const std::string& path) {
     }
     return true;
 }
+
+//size of the buffers used when streaming file contents
+const size_t IO_BUFFER_SIZE = 1 << 20;
+//mapped files are consumed in windows of this size and each window is
+//dropped from memory once used, which bounds the resident size per file
+const size_t IO_WINDOW_SIZE = 8 << 20;
+
+//read-only view of a whole file, memory mapped where the platform allows it
+//so large files are paged in by the kernel instead of copied into the heap
+class MappedFile {
+  private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    bool opened = false;
+    bool mapped = false;
+    string fallback;
+
+  public:
+    explicit MappedFile(const string& path){
+#ifndef _WIN32
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) return;
+      struct stat st;
+      if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)){
+        opened = true;
+        length = st.st_size;
+        traceCount(TRACE_FILES_READ);
+        traceCount(TRACE_BYTES_READ, length);
+        if (length > 0){
+          void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (view != MAP_FAILED){
+            bytes = static_cast<const char*>(view);
+            mapped = true;
+            madvise(view, length, MADV_SEQUENTIAL);
+          }
+        }
+      }
+      close(fd);
+      if (opened && length > 0 && !mapped){
+        fallback = readFile(path);
+        bytes = fallback.data();
+        length = fallback.size();
+      }
+#else
+      if (!fileExists(path)) return;
+      opened = true;
+      fallback = readFile(path);
+      bytes = fallback.data();
+      length = fallback.size();
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile(){
+#ifndef _WIN32
+      if (mapped) munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    bool ok() const { return opened; }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+    //drops the pages of an already consumed range from memory
+    void release(size_t offset, size_t size) const {
+#ifndef _WIN32
+      if (!mapped || offset >= length) return;
+      size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+      size_t start = (offset + pageSize - 1) / pageSize * pageSize;//only whole pages inside the range
+      size_t end = min(offset + size, length);
+      if (end > start) madvise(const_cast<char*>(bytes) + start, end - start, MADV_DONTNEED);
+#else
+      (void)offset;
+      (void)size;
+#endif
+    }
+
+    //hands the file from start onwards to fn one window at a time, releasing
+    //the pages of each window afterwards; stops early if fn returns false
+    bool forEachWindow(const function<bool(const char*, size_t)>& fn, size_t start = 0) const {
+      for (size_t offset = start; offset < length; offset += IO_WINDOW_SIZE){
+        size_t size = min(IO_WINDOW_SIZE, length - offset);
+        if (!fn(bytes + offset, size)) return false;
+        release(offset, size);
+      }
+      return true;
+    }
+};
+
+//reads the file in fixed size pieces and hands each one to sink
+//memory use stays at one buffer no matter how large the file is
+bool streamFile(const string& path, const function<bool(const char*, size_t)>& sink){
+  ifstream file(path, ios::binary);
+  if (!file.is_open()){
+    cout << "Error: Could not open file for reading: " << path << std::endl;
+    return false;
+  }
+  vector<char> buffer(IO_BUFFER_SIZE);
+  while (file){
+    file.read(buffer.data(), buffer.size());
+    streamsize got = file.gcount();
+    traceCount(TRACE_BYTES_READ, got);
+    if (got > 0 && !sink(buffer.data(), got)) return false;
+  }
+  traceCount(TRACE_FILES_READ);
+  return !file.bad();
+}
+
+//how hard writes try to survive a crash, from core.durability:
+//  none   - files are still replaced by rename, nothing is synced
+//  batch  - new objects are synced as one group right before a ref, HEAD or
+//           the index is replaced, and that file is synced before its rename
+//  strict - every file and the directory holding it is synced as it is written
+enum Durability { DURABILITY_NONE, DURABILITY_BATCH, DURABILITY_STRICT };
+
+Durability durability = DURABILITY_BATCH;
+
+bool parseDurability(const string& name, Durability& level){
+  if (name == "none") level = DURABILITY_NONE;
+  else if (name == "batch") level = DURABILITY_BATCH;
+  else if (name == "strict") level = DURABILITY_STRICT;
+  else return false;
+  return true;
+}
+
+//flushes a file or directory to the disk; filesystems that can't sync a
+//directory (EINVAL) don't count as a failure
+bool syncPath(const string& path){
+#ifndef _WIN32
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  bool ok = fsync(fd) == 0 || errno == EINVAL;
+  close(fd);
+  return ok;
+#else
+  int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+  if (fd < 0) return true;//directories can't be opened or synced here
+  bool ok = _commit(fd) == 0;
+  _close(fd);
+  return ok;
+#endif
+}
+
+//files and directories written since the last flushSyncs()
+class SyncQueue {
+  private:
+    mutex lock;
+    set<string> paths;
+
+  public:
+    void add(const string& path){
+      string parent = filesystem::path(path).parent_path().string();
+      lock_guard<mutex> guard(lock);
+      paths.insert(path);
+      paths.insert(parent.empty() ? "." : parent);
+    }
+
+    vector<string> take(){
+      lock_guard<mutex> guard(lock);
+      vector<string> taken(paths.begin(), paths.end());
+      paths.clear();
+      return taken;
+    }
+};
+
+SyncQueue pendingSyncs;
+
+//makes a new file, and its entry in the directory holding it, durable:
+//right away when strict, with the next flushSyncs() when batch
+bool syncLater(const string& path){
+  if (durability == DURABILITY_STRICT){
+    string parent = filesystem::path(path).parent_path().string();
+    return syncPath(path) && syncPath(parent.empty() ? "." : parent);
+  }
+  if (durability == DURABILITY_BATCH) pendingSyncs.add(path);
+  return true;
+}
+
+//syncs everything syncLater() queued as one group; on Linux a single
+//syncfs() covers them all, which costs about as much as one fsync
+bool flushSyncs(){
+  vector<string> paths = pendingSyncs.take();
+  if (paths.empty()) return true;
+#if defined(__linux__)
+  int fd = open(paths[0].c_str(), O_RDONLY);
+  if (fd >= 0){
+    bool ok = syncfs(fd) == 0;
+    close(fd);
+    if (ok) return true;
+  }
+#endif
+  bool ok = true;
+  for (const string& path : paths) ok = syncPath(path) && ok;
+  return ok;
+}
+
+//how a FileWriter puts its file in place
+enum WriteMode {
+  WRITE_IN_PLACE,//truncates and writes the target itself (working files)
+  WRITE_BATCHED,//new content-addressed files nothing points at yet (objects,
+                //packs): written to a temp file and linked into place, a file
+                //another writer put there first is kept, synced per durability
+  WRITE_REPLACE//files pointing at others (refs, HEAD, the index): pending syncs
+               //are flushed first, then the temp file is synced and renamed
+};
+
+//temp names are unique per process and write so parallel writers never share one
+string tempPathFor(const string& path){
+  static atomic<uint64_t> counter(0);
+#ifndef _WIN32
+  uint64_t process = uint64_t(getpid());
+#else
+  uint64_t process = uint64_t(chrono::steady_clock::now().time_since_epoch().count());
+#endif
+  return path + ".tmp-" + to_string(process) + "-" + to_string(counter++);
+}
+
+//files of writes in progress or interrupted by a crash (temp files and
+//the lock files of LockFile), never valid refs or objects
+bool isTempFile(const string& name){
+  return name.find(".tmp-") != string::npos ||
+         (name.size() > 5 && name.compare(name.size() - 5, 5, ".lock") == 0);
+}
+
+//writes a file through a fixed buffer, large pieces go straight to the kernel
+//the expected size is reserved up front (fallocate) to avoid fragmentation
+//outside WRITE_IN_PLACE the target only ever holds a complete file: the data
+//goes to a temp file that close() renames over it
+class FileWriter {
+  private:
+    string path;
+    string writePath;//path, or the temp file standing in for it
+    WriteMode mode = WRITE_IN_PLACE;
+    int fd = -1;
+    vector<char> buffer;
+    size_t buffered = 0;
+    uint64_t written = 0;
+    bool failed = false;
+    bool quiet = false;
+    string lastError;
+
+    void fail(const string& message){
+      lastError = message + ": " + path;
+      if (!quiet) cout <<"Error: " <<lastError <<endl;
+    }
+
+    bool flushBuffer(){
+      if (!writeAll(buffer.data(), buffered)) return false;
+      buffered = 0;
+      return true;
+    }
+
+    bool writeAll(const char* data, size_t size){
+      while (size > 0){
+#ifndef _WIN32
+        ssize_t done = ::write(fd, data, size);
+#else
+        int done = _write(fd, data, unsigned(min(size, size_t(1) << 30)));
+#endif
+        if (done < 0){
+          if (errno == EINTR) continue;
+          failed = true;
+          return false;
+        }
+        data += done;
+        size -= done;
+      }
+      return true;
+    }
+
+  public:
+    //keeps errors for error() instead of printing them, for callers on worker threads
+    void silence(){ quiet = true; }
+    const string& error() const { return lastError; }
+
+    //stagingPath replaces the temp file name, for writes through a LockFile
+    bool open(const string& target, uint64_t expectedSize = 0, WriteMode writeMode = WRITE_IN_PLACE,
+              const string& stagingPath = ""){
+      path = target;
+      mode = writeMode;
+      writePath = mode == WRITE_IN_PLACE ? path : stagingPath.empty() ? tempPathFor(path) : stagingPath;
+#ifndef _WIN32
+      fd = ::open(writePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#else
+      fd = _open(writePath.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#endif
+      if (fd < 0){
+        fail("Could not open file for writing");
+        return false;
+      }
+#if defined(__linux__)
+      if (expectedSize > 0) posix_fallocate(fd, 0, expectedSize);//only a hint, ignore failures
+#else
+      (void)expectedSize;
+#endif
+      buffer.resize(IO_BUFFER_SIZE);
+      return true;
+    }
+
+    bool write(const char* data, size_t size){
+      if (fd < 0 || failed) return false;
+      written += size;
+      if (buffered + size <= buffer.size()){
+        memcpy(buffer.data() + buffered, data, size);
+        buffered += size;
+        return true;
+      }
+      if (!flushBuffer()) return false;
+      if (size >= buffer.size()) return writeAll(data, size);//no point copying large pieces
+      memcpy(buffer.data(), data, size);
+      buffered = size;
+      return true;
+    }
+
+    //flushes, trims any unused preallocation and closes the file, then
+    //moves a temp file into place as the write mode asks
+    bool close(){
+      if (fd < 0) return false;
+      bool ok = !failed && flushBuffer();
+      bool syncNow = durability == DURABILITY_STRICT || (mode == WRITE_REPLACE && durability == DURABILITY_BATCH);
+#ifndef _WIN32
+      if (ok && ftruncate(fd, written) != 0) ok = false;
+      if (ok && mode != WRITE_IN_PLACE && syncNow && fsync(fd) != 0) ok = false;
+#if defined(__linux__)
+      //starts the writeback now so the group sync later has less to wait for
+      if (ok && mode == WRITE_BATCHED && durability == DURABILITY_BATCH) sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+      if (::close(fd) != 0) ok = false;
+#else
+      if (ok && mode != WRITE_IN_PLACE && syncNow && _commit(fd) != 0) ok = false;
+      if (_close(fd) != 0) ok = false;
+#endif
+      fd = -1;
+      traceCount(TRACE_FILES_WRITTEN);
+      traceCount(TRACE_BYTES_WRITTEN, written);
+      if (!ok){
+        fail("Could not write file");
+        if (mode != WRITE_IN_PLACE) remove(writePath.c_str());
+        return false;
+      }
+      if (mode == WRITE_IN_PLACE) return true;
+
+      //whatever the new file points at has to be on disk before it is
+      if (mode == WRITE_REPLACE && durability != DURABILITY_NONE && !flushSyncs()){
+        fail("Could not sync the objects written before");
+        remove(writePath.c_str());
+        return false;
+      }
+      error_code ec;
+#ifndef _WIN32
+      //the same id always means the same content, so whichever concurrent
+      //writer links first wins and the others just drop their copy
+      if (mode == WRITE_BATCHED && (link(writePath.c_str(), path.c_str()) == 0 || errno == EEXIST)){
+        remove(writePath.c_str());
+      } else {
+        filesystem::rename(writePath, path, ec);
+      }
+#else
+      filesystem::rename(writePath, path, ec);
+#endif
+      if (ec){
+        fail("Could not move file into place (" + ec.message() + ")");
+        remove(writePath.c_str());
+        return false;
+      }
+      string parent = filesystem::path(path).parent_path().string();
+      if (parent.empty()) parent = ".";
+      if (mode == WRITE_BATCHED && durability == DURABILITY_BATCH) pendingSyncs.add(path);
+      else if (syncNow && !syncPath(parent)) ok = false;
+      if (!ok) fail("Could not sync directory " + parent);
+      return ok;
+    }
+
+    ~FileWriter(){
+      if (fd >= 0) close();
+    }
+};
+
+//writes a buffer with a single preallocated write
+bool writeFile(const string& path, const char* data, size_t size, WriteMode mode = WRITE_IN_PLACE){
+  FileWriter writer;
+  return writer.open(path, size, mode) && writer.write(data, size) && writer.close();
+}
+
+//atomically replaces a small file that points at other data (a ref, HEAD,
+//the index, the config), see WRITE_REPLACE
+bool replaceFile(const string& path, const string& content){
+  return writeFile(path, content.data(), content.size(), WRITE_REPLACE);
+}
+
+//how long LockFile::acquire waits for another process, from core.lockTimeout
+long lockTimeoutMs = 10000;
+
+//an exclusive claim on a file shared between processes: path.lock is created
+//with O_EXCL, the new content is written into it and renamed over path, so a
+//read-check-write under the lock acts as a compare-and-swap
+//a held lock is removed again when the object goes away without commit()
+class LockFile {
+  private:
+    string path;
+    bool held = false;
+
+  public:
+    LockFile() = default;
+    LockFile(const LockFile&) = delete;
+    LockFile& operator=(const LockFile&) = delete;
+
+    ~LockFile(){
+      release();
+    }
+
+    string lockPath() const { return path + ".lock"; }
+
+    //retries with randomized exponential backoff (1 ms doubling up to 64 ms)
+    //until lockTimeoutMs has passed
+    bool acquire(const string& target){
+      path = target;
+      thread_local minstd_rand jitter(uint32_t(chrono::steady_clock::now().time_since_epoch().count()));
+      auto deadline = chrono::steady_clock::now() + chrono::milliseconds(lockTimeoutMs);
+      long delayMs = 1;
+      while (true){
+#ifndef _WIN32
+        int fd = ::open(lockPath().c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd >= 0) ::close(fd);
+#else
+        int fd = _open(lockPath().c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, 0644);
+        if (fd >= 0) _close(fd);
+#endif
+        if (fd >= 0){
+          held = true;
+          return true;
+        }
+        if (errno != EEXIST){
+          cout <<"Error: Could not create lock file " <<lockPath() <<": " <<strerror(errno) <<endl;
+          return false;
+        }
+        if (chrono::steady_clock::now() >= deadline){
+          cout <<"Error: Unable to lock " <<path <<", " <<lockPath() <<" exists. Another minigit process "
+               <<"seems to be running; if not, remove the lock file." <<endl;
+          return false;
+        }
+        this_thread::sleep_for(chrono::microseconds(delayMs * 500 + jitter() % (delayMs * 1000)));
+        delayMs = min(delayMs * 2, 64L);
+      }
+    }
+
+    //replaces path with content and gives up the lock, like replaceFile
+    bool commit(const string& content){
+      if (!held) return false;
+      held = false;
+      FileWriter writer;
+      bool ok = writer.open(path, content.size(), WRITE_REPLACE, lockPath()) &&
+                writer.write(content.data(), content.size()) && writer.close();
+      if (!ok) remove(lockPath().c_str());
+      return ok;
+    }
+
+    //gives up the lock and leaves path as it was
+    void release(){
+      if (!held) return;
+      held = false;
+      remove(lockPath().c_str());
+    }
+};
+
+//writes a whole mapped file into an open writer window by window
+bool writeMapped(FileWriter& writer, const MappedFile& source){
+  return source.forEachWindow([&](const char* data, size_t size){ return writer.write(data, size); });
+}
+
+//writes a mapped file to path with bounded memory use
+bool writeFile(const string& path, const MappedFile& source){
+  FileWriter writer;
+  return writer.open(path, source.size()) && writeMapped(writer, source) && writer.close();
+}
+
+//copies a file through the mapped view without holding it in the heap
+bool copyFile(const string& from, const string& to){
+  MappedFile source(from);
+  if (!source.ok()){
+    cout << "Error: Could not open file for reading: " << from << std::endl;
+    return false;
+  }
+  return writeFile(to, source);
+}
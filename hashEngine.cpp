@@ -0,0 +1,490 @@
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+//this file includes the content hash engines used for object ids
+//  blake3 - 256-bit BLAKE3, the default for new repositories (format version 2)
+//  djb2   - the original 64-bit hash, only kept to read legacy repositories
+//BLAKE3 hashes 1 KiB chunks as leaves of a binary tree, so large inputs are
+//hashed several chunks at a time with SIMD and whole subtrees on separate threads
+
+const size_t BLAKE3_BLOCK_LEN = 64;
+const size_t BLAKE3_CHUNK_LEN = 1024;
+const uint8_t BLAKE3_CHUNK_START = 1;
+const uint8_t BLAKE3_CHUNK_END = 2;
+const uint8_t BLAKE3_PARENT = 4;
+const uint8_t BLAKE3_ROOT = 8;
+
+const uint32_t BLAKE3_IV[8] = {
+  0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+  0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+const uint8_t BLAKE3_SCHEDULE[7][16] = {
+  {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+  {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+  {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+  {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+  {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+  {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+  {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+static inline uint32_t load32(const uint8_t* p){
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+static inline void store32(uint8_t* p, uint32_t value){
+  p[0] = uint8_t(value);
+  p[1] = uint8_t(value >> 8);
+  p[2] = uint8_t(value >> 16);
+  p[3] = uint8_t(value >> 24);
+}
+
+//the quarter round, written once and used for scalar words and SIMD vectors
+template <typename W>
+static inline __attribute__((always_inline)) void blake3G(W* v, int a, int b, int c, int d, W mx, W my){
+  v[a] = v[a] + v[b] + mx;
+  v[d] = v[d] ^ v[a]; v[d] = (v[d] >> 16) | (v[d] << 16);
+  v[c] = v[c] + v[d];
+  v[b] = v[b] ^ v[c]; v[b] = (v[b] >> 12) | (v[b] << 20);
+  v[a] = v[a] + v[b] + my;
+  v[d] = v[d] ^ v[a]; v[d] = (v[d] >> 8) | (v[d] << 24);
+  v[c] = v[c] + v[d];
+  v[b] = v[b] ^ v[c]; v[b] = (v[b] >> 7) | (v[b] << 25);
+}
+
+template <typename W>
+static inline __attribute__((always_inline)) void blake3Rounds(W* v, const W* m){
+  for (int r = 0; r < 7; ++r){
+    const uint8_t* s = BLAKE3_SCHEDULE[r];
+    blake3G(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    blake3G(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    blake3G(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    blake3G(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    blake3G(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    blake3G(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    blake3G(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    blake3G(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+}
+
+//compresses one 64 byte block, cv is updated to the new chaining value
+static void blake3Compress(uint32_t cv[8], const uint8_t block[64], uint8_t blockLen, uint64_t counter, uint8_t flags){
+  uint32_t m[16], v[16];
+  for (int i = 0; i < 16; ++i) m[i] = load32(block + 4 * i);
+  for (int i = 0; i < 8; ++i) v[i] = cv[i];
+  for (int i = 0; i < 4; ++i) v[8 + i] = BLAKE3_IV[i];
+  v[12] = uint32_t(counter);
+  v[13] = uint32_t(counter >> 32);
+  v[14] = blockLen;
+  v[15] = flags;
+  blake3Rounds(v, m);
+  for (int i = 0; i < 8; ++i) cv[i] = v[i] ^ v[i + 8];
+}
+
+//hashes `lanes` full chunks starting at consecutive chunk counters and writes
+//their 32 byte chaining values one after another to out
+typedef void (*Blake3ChunksKernel)(const uint8_t* const* inputs, uint64_t counter, uint8_t* out);
+
+static void blake3ChunksScalar(const uint8_t* const* inputs, uint64_t counter, uint8_t* out){
+  uint32_t cv[8];
+  memcpy(cv, BLAKE3_IV, sizeof(cv));
+  for (size_t b = 0; b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; ++b){
+    uint8_t flags = (b == 0 ? BLAKE3_CHUNK_START : 0) | (b == 15 ? BLAKE3_CHUNK_END : 0);
+    blake3Compress(cv, inputs[0] + b * BLAKE3_BLOCK_LEN, BLAKE3_BLOCK_LEN, counter, flags);
+  }
+  for (int i = 0; i < 8; ++i) store32(out + 4 * i, cv[i]);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MINIGIT_BLAKE3_SIMD 1
+
+//one lane per chunk: word i of every lane lives in the same vector register
+template <typename V, int LANES>
+static inline __attribute__((always_inline)) void blake3ChunksVector(const uint8_t* const* inputs, uint64_t counter, uint8_t* out){
+  V cv[8], v[16], m[16];
+  alignas(64) uint32_t words[16][LANES];
+  alignas(64) uint32_t counterLow[LANES], counterHigh[LANES];
+  for (int lane = 0; lane < LANES; ++lane){
+    counterLow[lane] = uint32_t(counter + lane);
+    counterHigh[lane] = uint32_t((counter + lane) >> 32);
+  }
+  for (int i = 0; i < 8; ++i) cv[i] = V{} + BLAKE3_IV[i];
+  for (size_t b = 0; b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; ++b){
+    uint8_t flags = (b == 0 ? BLAKE3_CHUNK_START : 0) | (b == 15 ? BLAKE3_CHUNK_END : 0);
+    for (int lane = 0; lane < LANES; ++lane){
+      const uint8_t* block = inputs[lane] + b * BLAKE3_BLOCK_LEN;
+      for (int w = 0; w < 16; ++w) words[w][lane] = load32(block + 4 * w);
+    }
+    for (int w = 0; w < 16; ++w) memcpy(&m[w], words[w], sizeof(V));
+    for (int i = 0; i < 8; ++i) v[i] = cv[i];
+    for (int i = 0; i < 4; ++i) v[8 + i] = V{} + BLAKE3_IV[i];
+    memcpy(&v[12], counterLow, sizeof(V));
+    memcpy(&v[13], counterHigh, sizeof(V));
+    v[14] = V{} + uint32_t(BLAKE3_BLOCK_LEN);
+    v[15] = V{} + uint32_t(flags);
+    blake3Rounds(v, m);
+    for (int i = 0; i < 8; ++i) cv[i] = v[i] ^ v[i + 8];
+  }
+  for (int i = 0; i < 8; ++i) memcpy(words[i], &cv[i], sizeof(V));
+  for (int lane = 0; lane < LANES; ++lane){
+    for (int i = 0; i < 8; ++i) store32(out + 32 * lane + 4 * i, words[i][lane]);
+  }
+}
+
+typedef uint32_t Blake3Vec4 __attribute__((vector_size(16)));
+typedef uint32_t Blake3Vec8 __attribute__((vector_size(32)));
+typedef uint32_t Blake3Vec16 __attribute__((vector_size(64)));
+
+__attribute__((target("sse4.1")))
+static void blake3ChunksSse41(const uint8_t* const* inputs, uint64_t counter, uint8_t* out){
+  blake3ChunksVector<Blake3Vec4, 4>(inputs, counter, out);
+}
+
+__attribute__((target("avx2")))
+static void blake3ChunksAvx2(const uint8_t* const* inputs, uint64_t counter, uint8_t* out){
+  blake3ChunksVector<Blake3Vec8, 8>(inputs, counter, out);
+}
+
+__attribute__((target("avx512f")))
+static void blake3ChunksAvx512(const uint8_t* const* inputs, uint64_t counter, uint8_t* out){
+  blake3ChunksVector<Blake3Vec16, 16>(inputs, counter, out);
+}
+#endif
+
+struct Blake3Kernel {
+  const char* name;
+  size_t lanes;
+  Blake3ChunksKernel hashChunks;
+};
+
+//picks the widest kernel the cpu supports, MINIGIT_HASH_KERNEL=<name> overrides it
+static Blake3Kernel selectBlake3Kernel(){
+  vector<Blake3Kernel> kernels;
+#ifdef MINIGIT_BLAKE3_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) kernels.push_back({"avx512", 16, blake3ChunksAvx512});
+  if (__builtin_cpu_supports("avx2")) kernels.push_back({"avx2", 8, blake3ChunksAvx2});
+  if (__builtin_cpu_supports("sse4.1")) kernels.push_back({"sse4.1", 4, blake3ChunksSse41});
+#endif
+  kernels.push_back({"scalar", 1, blake3ChunksScalar});
+
+  const char* forced = getenv("MINIGIT_HASH_KERNEL");
+  if (forced){
+    for (const Blake3Kernel& kernel : kernels){
+      if (string(kernel.name) == forced) return kernel;
+    }
+  }
+  return kernels.front();
+}
+
+const Blake3Kernel& blake3Kernel(){
+  static const Blake3Kernel kernel = selectBlake3Kernel();
+  return kernel;
+}
+
+static void blake3ParentCV(const uint8_t left[32], const uint8_t right[32], uint8_t out[32], uint8_t extraFlags = 0){
+  uint8_t block[64];
+  memcpy(block, left, 32);
+  memcpy(block + 32, right, 32);
+  uint32_t cv[8];
+  memcpy(cv, BLAKE3_IV, sizeof(cv));
+  blake3Compress(cv, block, 64, 0, BLAKE3_PARENT | extraFlags);
+  for (int i = 0; i < 8; ++i) store32(out + 4 * i, cv[i]);
+}
+
+//the state of the chunk currently being filled
+struct Blake3ChunkState {
+  uint32_t cv[8];
+  uint64_t counter;
+  uint8_t block[64];
+  size_t blockLen;
+  size_t blocksCompressed;
+
+  void reset(uint64_t chunkCounter){
+    memcpy(cv, BLAKE3_IV, sizeof(cv));
+    counter = chunkCounter;
+    blockLen = 0;
+    blocksCompressed = 0;
+    memset(block, 0, sizeof(block));
+  }
+
+  size_t length() const {
+    return blocksCompressed * BLAKE3_BLOCK_LEN + blockLen;
+  }
+
+  uint8_t startFlag() const {
+    return blocksCompressed == 0 ? BLAKE3_CHUNK_START : 0;
+  }
+
+  void update(const uint8_t* input, size_t size){
+    while (size > 0){
+      if (blockLen == BLAKE3_BLOCK_LEN){
+        blake3Compress(cv, block, BLAKE3_BLOCK_LEN, counter, startFlag());
+        blocksCompressed++;
+        blockLen = 0;
+        memset(block, 0, sizeof(block));
+      }
+      size_t take = min(BLAKE3_BLOCK_LEN - blockLen, size);
+      memcpy(block + blockLen, input, take);
+      blockLen += take;
+      input += take;
+      size -= take;
+    }
+  }
+
+  //chaining value of a chunk that is not the root
+  void chainingValue(uint8_t out[32]) const {
+    uint32_t state[8];
+    memcpy(state, cv, sizeof(state));
+    blake3Compress(state, block, blockLen, counter, startFlag() | BLAKE3_CHUNK_END);
+    for (int i = 0; i < 8; ++i) store32(out + 4 * i, state[i]);
+  }
+
+  void rootHash(uint8_t out[32]) const {
+    uint32_t state[8];
+    memcpy(state, cv, sizeof(state));
+    blake3Compress(state, block, blockLen, 0, startFlag() | BLAKE3_CHUNK_END | BLAKE3_ROOT);
+    for (int i = 0; i < 8; ++i) store32(out + 4 * i, state[i]);
+  }
+};
+
+//inputs at least this large are split across threads
+const size_t BLAKE3_PARALLEL_MIN = 1 << 20;
+//a perfect subtree of at most this many chunks is hashed with the SIMD kernel
+const size_t BLAKE3_BATCH_CHUNKS = 64;
+
+static size_t blake3LeftLength(size_t size){
+  size_t fullChunks = (size - 1) / BLAKE3_CHUNK_LEN;
+  size_t power = 1;
+  while (power * 2 <= fullChunks) power *= 2;
+  return power * BLAKE3_CHUNK_LEN;
+}
+
+//chaining value of the (non-root) subtree covering input, whose first chunk
+//has index chunkCounter
+static void blake3SubtreeCV(const uint8_t* input, size_t size, uint64_t chunkCounter, uint8_t out[32]){
+  if (size <= BLAKE3_CHUNK_LEN){
+    Blake3ChunkState chunk;
+    chunk.reset(chunkCounter);
+    chunk.update(input, size);
+    chunk.chainingValue(out);
+    return;
+  }
+
+  size_t chunks = size / BLAKE3_CHUNK_LEN;
+  bool perfect = size % BLAKE3_CHUNK_LEN == 0 && (chunks & (chunks - 1)) == 0;
+  const Blake3Kernel& kernel = blake3Kernel();
+  if (perfect && chunks <= BLAKE3_BATCH_CHUNKS && chunks >= kernel.lanes){
+    uint8_t cvs[BLAKE3_BATCH_CHUNKS * 32];
+    const uint8_t* inputs[16];
+    for (size_t c = 0; c < chunks; c += kernel.lanes){
+      for (size_t lane = 0; lane < kernel.lanes; ++lane) inputs[lane] = input + (c + lane) * BLAKE3_CHUNK_LEN;
+      kernel.hashChunks(inputs, chunkCounter + c, cvs + 32 * c);
+    }
+    //fold the chaining values pairwise up to the root of this subtree
+    for (size_t width = chunks; width > 1; width /= 2){
+      for (size_t i = 0; i < width / 2; ++i) blake3ParentCV(cvs + 64 * i, cvs + 64 * i + 32, cvs + 32 * i);
+    }
+    memcpy(out, cvs, 32);
+    return;
+  }
+
+  size_t leftSize = blake3LeftLength(size);
+  uint8_t children[64];
+  blake3SubtreeCV(input, leftSize, chunkCounter, children);
+  blake3SubtreeCV(input + leftSize, size - leftSize, chunkCounter + leftSize / BLAKE3_CHUNK_LEN, children + 32);
+  blake3ParentCV(children, children + 32, out);
+}
+
+//the workers that hash parts of large inputs, one less than the cores since
+//the caller hashes a part too; null on a single core
+static ThreadPool* blake3Pool(){
+  static unique_ptr<ThreadPool> pool(thread::hardware_concurrency() > 1 ?
+                                     new ThreadPool(thread::hardware_concurrency() - 1) : nullptr);
+  return pool.get();
+}
+
+//chaining value of a perfect subtree of `chunks` chunks; large ones are cut
+//into equal parts hashed on blake3Pool, unless the caller is a pool worker
+//itself (add and chunked writes already hash one file per worker)
+static void blake3ParallelCV(const uint8_t* input, uint64_t chunks, uint64_t chunkCounter, uint8_t out[32]){
+  size_t size = chunks * BLAKE3_CHUNK_LEN;
+  ThreadPool* pool = size >= BLAKE3_PARALLEL_MIN && !onPoolWorker ? blake3Pool() : nullptr;
+  uint64_t parts = 1;
+  while (pool && parts < pool->size() + 1 && (chunks / (parts * 2)) * BLAKE3_CHUNK_LEN >= BLAKE3_PARALLEL_MIN / 4) parts *= 2;
+  if (parts == 1){
+    blake3SubtreeCV(input, size, chunkCounter, out);
+    return;
+  }
+  uint64_t partChunks = chunks / parts;
+  size_t partSize = partChunks * BLAKE3_CHUNK_LEN;
+  vector<uint8_t> cvs(parts * 32);
+  mutex lock;
+  condition_variable finished;
+  size_t left = parts - 1;
+  for (uint64_t i = 1; i < parts; ++i){
+    pool->submit([&, i]{
+      blake3SubtreeCV(input + i * partSize, partSize, chunkCounter + i * partChunks, cvs.data() + 32 * i);
+      lock_guard<mutex> guard(lock);
+      if (--left == 0) finished.notify_one();
+    });
+  }
+  blake3SubtreeCV(input, partSize, chunkCounter, cvs.data());
+  {
+    unique_lock<mutex> guard(lock);
+    finished.wait(guard, [&]{ return left == 0; });
+  }
+  for (uint64_t width = parts; width > 1; width /= 2){
+    for (uint64_t i = 0; i < width / 2; ++i) blake3ParentCV(cvs.data() + 64 * i, cvs.data() + 64 * i + 32, cvs.data() + 32 * i);
+  }
+  memcpy(out, cvs.data(), 32);
+}
+
+//common interface of the hash engines, data can be fed in pieces
+class ContentHasher {
+  public:
+    virtual void update(const void* data, size_t size) = 0;
+    virtual string hexDigest() = 0;
+    virtual ~ContentHasher(){}
+};
+
+string toHex(const uint8_t* bytes, size_t size){
+  static const char digits[] = "0123456789abcdef";
+  string hex(size * 2, '0');
+  for (size_t i = 0; i < size; ++i){
+    hex[2 * i] = digits[bytes[i] >> 4];
+    hex[2 * i + 1] = digits[bytes[i] & 15];
+  }
+  return hex;
+}
+
+//streaming BLAKE3: the last chunk is always held back in chunkState because
+//only finalize() knows if it is the root
+class Blake3Hasher : public ContentHasher {
+  private:
+    Blake3ChunkState chunkState;
+    vector<array<uint8_t, 32>> cvStack;//one entry per completed subtree, largest first
+
+    //adds the chaining value of a subtree of `chunks` chunks that ends at
+    //the current chunk counter, merging completed subtrees on the stack
+    void pushSubtree(const uint8_t cv[32], uint64_t chunks, uint64_t totalChunks){
+      array<uint8_t, 32> node;
+      memcpy(node.data(), cv, 32);
+      uint64_t units = totalChunks / chunks;
+      while ((units & 1) == 0){
+        blake3ParentCV(cvStack.back().data(), node.data(), node.data());
+        cvStack.pop_back();
+        units >>= 1;
+      }
+      cvStack.push_back(node);
+    }
+
+  public:
+    Blake3Hasher(){
+      chunkState.reset(0);
+    }
+
+    void update(const void* data, size_t size) override {
+      traceCount(TRACE_BYTES_HASHED, size);
+      const uint8_t* input = static_cast<const uint8_t*>(data);
+      while (size > 0){
+        if (chunkState.length() == BLAKE3_CHUNK_LEN){
+          uint8_t cv[32];
+          chunkState.chainingValue(cv);
+          uint64_t total = chunkState.counter + 1;
+          pushSubtree(cv, 1, total);
+          chunkState.reset(total);
+        }
+        if (chunkState.length() == 0 && size > BLAKE3_CHUNK_LEN){
+          //largest aligned subtree that still leaves input for the final chunk
+          uint64_t counter = chunkState.counter;
+          uint64_t chunks = 1;
+          while ((chunks * 2) * BLAKE3_CHUNK_LEN < size && counter % (chunks * 2) == 0) chunks *= 2;
+          if (chunks > 1){
+            uint8_t cv[32];
+            blake3ParallelCV(input, chunks, counter, cv);
+            pushSubtree(cv, chunks, counter + chunks);
+            chunkState.reset(counter + chunks);
+            input += chunks * BLAKE3_CHUNK_LEN;
+            size -= chunks * BLAKE3_CHUNK_LEN;
+            continue;
+          }
+        }
+        size_t take = min(BLAKE3_CHUNK_LEN - chunkState.length(), size);
+        chunkState.update(input, take);
+        input += take;
+        size -= take;
+      }
+    }
+
+    string hexDigest() override {
+      uint8_t out[32];
+      if (cvStack.empty()){
+        chunkState.rootHash(out);
+        return toHex(out, 32);
+      }
+      uint8_t node[32];
+      chunkState.chainingValue(node);
+      for (size_t i = cvStack.size(); i-- > 1;){
+        blake3ParentCV(cvStack[i].data(), node, node);
+      }
+      blake3ParentCV(cvStack[0].data(), node, out, BLAKE3_ROOT);
+      return toHex(out, 32);
+    }
+};
+
+//the original 64-bit djb2 hash, kept so format version 1 repositories still work
+class Djb2Hasher : public ContentHasher {
+  private:
+    unsigned long hash = 5381; // djb2 hash constant
+
+  public:
+    void update(const void* data, size_t size) override {
+      traceCount(TRACE_BYTES_HASHED, size);
+      const unsigned char* bytes = static_cast<const unsigned char*>(data);
+      for (size_t i = 0; i < size; ++i){
+        hash = ((hash << 5) + hash) + bytes[i]; // hash * 33 + c
+      }
+    }
+
+    string hexDigest() override {
+      std::stringstream ss;
+      ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+      return ss.str();
+    }
+};
+
+const string HASH_BLAKE3 = "blake3";
+const string HASH_DJB2 = "djb2";
+
+//the engine used by generateHash, chosen from the repository format
+string activeHashAlgorithm = HASH_BLAKE3;
+
+unique_ptr<ContentHasher> makeHasher(const string& algorithm){
+  if (algorithm == HASH_DJB2) return unique_ptr<ContentHasher>(new Djb2Hasher());
+  return unique_ptr<ContentHasher>(new Blake3Hasher());
+}
+
+string hashWith(const string& algorithm, const void* data, size_t size){
+  unique_ptr<ContentHasher> hasher = makeHasher(algorithm);
+  hasher->update(data, size);
+  return hasher->hexDigest();
+}
+
+//length of the hex ids an algorithm produces
+size_t hashHexLength(const string& algorithm){
+  return algorithm == HASH_DJB2 ? 16 : 64;
+}
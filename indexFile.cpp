@@ -0,0 +1,110 @@
+#include <string>
+#include <sstream>
+#include <unordered_map>
+
+using namespace std;
+
+//this file includes the binary staging area (index) format
+//every entry keeps the stat data of the file next to its blob hash so
+//unchanged files can be recognised without reading or hashing them
+
+const char INDEX_MAGIC[4] = {'M', 'G', 'I', 'X'};
+const uint32_t INDEX_VERSION = 1;
+
+struct IndexEntry {
+  string blobHash;
+  FileStat stat;
+};
+
+typedef unordered_map<string, IndexEntry> StagingIndex;
+
+string encodeIndex(const StagingIndex& index){
+  string out(INDEX_MAGIC, 4);
+  putU32(out, INDEX_VERSION);
+  putU32(out, index.size());
+  for (const auto& entry : index){
+    const FileStat& st = entry.second.stat;
+    putU64(out, st.size);
+    putU64(out, st.mtimeNs);
+    putU64(out, st.ctimeNs);
+    putU64(out, st.inode);
+    putU32(out, st.mode);
+    putU16(out, entry.first.size());
+    out.push_back(char(entry.second.blobHash.size()));
+    out += entry.first;
+    out += entry.second.blobHash;
+  }
+  return out;
+}
+
+//reads both the binary format and the old text format of 'path hash' lines
+bool decodeIndex(const string& data, StagingIndex& index){
+  index.clear();
+  if (data.size() < 4 || data.compare(0, 4, INDEX_MAGIC, 4) != 0){
+    stringstream ss(data);
+    string line;
+    while (getline(ss, line)) {
+      if (line.empty()) continue;
+      size_t spacePos = line.find(' ');
+      string blobHash = spacePos == string::npos ? "" : line.substr(spacePos + 1);
+      if (spacePos == 0 || blobHash.empty() || blobHash.find_first_not_of("0123456789abcdef") != string::npos){
+        cout <<"Error: index file is corrupt" <<endl;
+        index.clear();
+        return false;
+      }
+      IndexEntry entry;//no stat data, so the first add or status rehashes it
+      entry.blobHash = blobHash;
+      index[normalizePath(line.substr(0, spacePos))] = entry;
+    }
+    return true;
+  }
+
+  ByteReader reader(data.data() + 4, data.size() - 4);
+  uint32_t version = reader.u32();
+  if (version != INDEX_VERSION){
+    cout <<"Error: unsupported index version " <<version <<endl;
+    return false;
+  }
+  uint32_t count = reader.u32();
+  for (uint32_t i = 0; i < count && reader.ok(); ++i){
+    IndexEntry entry;
+    entry.stat.size = reader.u64();
+    entry.stat.mtimeNs = reader.u64();
+    entry.stat.ctimeNs = reader.u64();
+    entry.stat.inode = reader.u64();
+    entry.stat.mode = reader.u32();
+    uint16_t pathLength = reader.u16();
+    uint8_t hashLength = reader.u8();
+    string path = reader.bytes(pathLength);
+    entry.blobHash = reader.bytes(hashLength);
+    index[path] = entry;
+  }
+  if (!reader.ok()){
+    cout <<"Error: index file is truncated or corrupt" <<endl;
+    index.clear();
+    return false;
+  }
+  return true;
+}
+
+//true when the file on disk still has the stat data recorded in the index
+//a file modified in the same instant the index was written is 'racy' and
+//always rehashed, since a later change in that instant keeps the same mtime
+bool statMatches(const IndexEntry& entry, const FileStat& current, int64_t indexWrittenNs){
+  if (entry.stat.mtimeNs == 0) return false;
+  if (entry.stat.mtimeNs >= indexWrittenNs) return false;
+  return entry.stat.size == current.size &&
+         entry.stat.mtimeNs == current.mtimeNs &&
+         entry.stat.ctimeNs == current.ctimeNs &&
+         entry.stat.inode == current.inode &&
+         entry.stat.mode == current.mode;
+}
+
+//the filename -> blob hash view used by commits
+unordered_map<string, string> indexBlobs(const StagingIndex& index){
+  unordered_map<string, string> blobs;
+  for (const auto& entry : index){
+    blobs[entry.first] = entry.second.blobHash;
+  }
+  return blobs;
+}
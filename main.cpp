@@ -1,4 +1,6 @@
 #include "MiniGit.cpp"
+#include <cerrno>
+#include <cstdlib>
 
 using namespace std;
 
@@ -8,93 +10,156 @@ void info(){
     cout << "./minigit init                               ->   initialize an empty git repository in the current dir\n";
     cout << "./minigit add <'.'or 'file_name(s)'>           ->   add the file(s) to staging area ('.' for all files)\n";
     cout << "./minigit commit -m <'commit message'>       ->   commit your staging files\n";
-    cout << "./minigit log                                ->   show commit history\n";
+    cout << "./minigit status                             ->   show staged, modified and untracked files\n";
+    cout << "./minigit log [-n <count>] [--since=<date>] [--until=<date>] [--format=<format>] [-- <path>]\n";
+    cout << "                                             ->   show commit history, optionally only the commits that changed path\n";
+    cout << "                                                  format takes %H %h %P %p %d %s %n, or oneline\n";
     cout << "./minigit branch <branch_name>               ->   create a new branch\n";
-    cout << "./minigit branch <branch>               ->   view branch list\n";
-    cout << "./minigit checkout <branch_name_or_commit_hash> ->   switch to a branch or a commit\n";
+    cout << "./minigit branch [--list <prefix>]           ->   view branch list, or the branches starting with prefix\n";
+    cout << "./minigit checkout <branch_name_or_commit_hash> ->   switch to a branch or a commit, ids may be shortened to 4+ characters\n";
     cout << "./minigit merge <branch_name>                ->   merge changes from another branch\n";
-    cout << "./minigit diff <file1> <file2>               ->   show differences between two files\n";
+    cout << "./minigit diff <a> <b>                       ->   show a unified diff of two files, blobs or commits\n";
+    cout << "./minigit gc                                 ->   pack loose objects into a packfile and refs into packed-refs\n";
+    cout << "./minigit migrate                            ->   upgrade a legacy repository to blake3 object ids\n";
+    cout << "--trace=<file> before or after any command   ->   write a Chrome trace of its phases and counters to file\n";
+}
+
+//reads 'log [-n <count>] [--since=<date>] [--until=<date>] [--format=<format>] [-- <path>]'
+bool parseLogOptions(int argc, char* argv[], LogOptions& options){
+  for (int i = 2; i < argc; ++i){
+    string arg = argv[i];
+    if (arg == "--"){
+      if (i + 1 < argc) options.path = normalizePath(argv[i + 1]);
+      if (options.path == ".") options.path = "";
+      while (!options.path.empty() && options.path.back() == '/') options.path.pop_back();
+      break;
+    }
+    string count;
+    if (arg == "-n" && i + 1 < argc) count = argv[++i];
+    else if (arg.rfind("-n", 0) == 0 && arg.size() > 2) count = arg.substr(2);
+    if (!count.empty() || arg == "-n"){
+      errno = 0;
+      unsigned long long value = count.empty() ? 0 : strtoull(count.c_str(), nullptr, 10);
+      if (count.empty() || count.find_first_not_of("0123456789") != string::npos || errno == ERANGE){
+        cout << "Error: -n needs a number of commits\n";
+        return false;
+      }
+      options.maxCount = value;
+    } else if (arg.rfind("--since=", 0) == 0 || arg.rfind("--until=", 0) == 0){
+      bool until = arg[2] == 'u';
+      if (!parseLogDate(arg.substr(8), until, until ? options.until : options.since)){
+        cout << "Error: could not read the date in " << arg << " (use YYYY-MM-DD [HH:MM[:SS]])\n";
+        return false;
+      }
+    } else if (arg.rfind("--format=", 0) == 0){
+      options.format = arg.substr(9);
+      if (options.format == "oneline") options.format = "%h %s";
+    } else {
+      cout << "Error: unknown log option " << arg << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+//removes --trace=<file> from the arguments and returns the file, "" if absent
+string takeTraceOption(int& argc, char* argv[]){
+  string path;
+  int kept = 1;
+  for (int i = 1; i < argc; ++i){
+    string arg = argv[i];
+    if (arg.rfind("--trace=", 0) == 0) path = arg.substr(8);
+    else argv[kept++] = argv[i];
+  }
+  argc = kept;
+  return path;
 }
 
 
 int main(int argc, char* argv[]){
+  string tracePath = takeTraceOption(argc, argv);
+  if (!tracePath.empty()) startTracing();
   
   MiniGit git;
+  bool ok = true;//the exit status follows the command's result
   
   if (argc >= 2){
     string command = argv[1];
+    if (git.usesLegacyFormat() && command != "migrate") {
+      cout << "Note: this repository uses the legacy djb2 object format, run ./minigit migrate to upgrade.\n";
+    }
     if (command == "init"){
-      git.initialize();
+      ok = git.initialize();
     } else if (command == "add") {
             if (argc < 3) {
+                ok = false;
                 cout << "missing arguments!" << endl;
                 cout << "Provide a file or '.' to add all files in current directory e.g." << endl;
                 cout << "./minigit add <file_name> or ./minigit add ." << endl;
             } else {
                 string target = string(argv[2]);
+                // Stage everything in one batch so the index is read and written once
                 if (target == ".") {
-                    error_code ec;
-                    for (const auto& entry : filesystem::directory_iterator(".", ec)) {
-                        // Ensure the entry exists and is a regular file before attempting to add
-                        if (entry.exists(ec) && entry.is_regular_file(ec)) { 
-                            string filePath = entry.path().string();
-                            // Skip the minigit executable and any files/directories within .minigit/
-                            // The MINIGIT_DIR constant is assumed to be accessible from MiniGit.cpp
-                            if (filesystem::path(filePath).filename() != "minigit" && 
-                                filesystem::path(filePath).filename() != "minigit.exe" &&
-                                filePath.rfind(MINIGIT_DIR, 0) != 0) { 
-                                git.addFiles(filePath);
-                            }
-                        }
-                    } 
-                    if (ec) {
-                        cout <<"Error listing files in current directory: " << ec.message() <<endl;
-                    }
+                    ok = git.addAll();
                 } else {
+                    vector<string> paths;
                     for (int i = 2; i < argc; ++i) {
-                        git.addFiles(string(argv[i]));
+                        paths.push_back(string(argv[i]));
                     }
+                    ok = git.addFiles(paths);
                 }
             }
         } else if (command == "commit") {
             if (argc == 4 && string(argv[2]) == "-m") {
                 string message = string(argv[3]);
-                git.commit(message);
+                ok = git.commit(message);
             } else {
+                ok = false;
                 cout << "missing arguments!\n";
                 cout << "Provide with a message field e.g.\n";
                 cout << "./minigit commit -m 'my commit message'" << endl;
             }
+        } else if (command == "gc"){
+              ok = git.gc();
+        } else if (command == "migrate"){
+              ok = git.migrate();
+        } else if (command == "status"){
+              ok = git.status();
         } else if (command == "log"){
-              git.viewLog();
+              LogOptions options;
+              ok = parseLogOptions(argc, argv, options);
+              if (ok) git.viewLog(options);
             } else if (command == "branch") {
             if (argc < 3) {
                 git.showBranches();
+            } else if (string(argv[2]) == "--list") {
+                git.showBranches(argc > 3 ? string(argv[3]) : "");
             } else {
                 string name = string(argv[2]);
-                git.branching(name);
+                ok = git.branching(name);
             }
         } else if (command == "checkout"){
-              git.checkOut(argv[2]);
+              ok = argc >= 3 && git.checkOut(argv[2]);
         } else if (command == "merge") {
             if (argc < 3) {
+                ok = false;
                 cout << "missing arguments!" << endl;
                 cout << "Provide a branch name to merge from e.g." << endl;
                 cout << "./minigit merge <branch_name>" << endl;
             } else {
-                git.mergeBranch(argv[2]);
+                ok = git.mergeBranch(argv[2]);
             }
         } else if (command == "diff") {
             if (argc < 4) {
+                ok = false;
                 cout << "missing arguments!" << endl;
-                cout << "Provide two file paths e.g." << endl;
-                cout << "./minigit diff <file1> <file2>" << endl;
+                cout << "Provide two files, blobs or commits e.g." << endl;
+                cout << "./minigit diff <file1> <file2> or ./minigit diff main feature" << endl;
             } else {
-                string file1 = string(argv[2]);
-                string file2 = string(argv[3]);
-                git.diffViewer(file1, file2);
+                ok = git.diff(string(argv[2]), string(argv[3]));
             }
         }else{
+          ok = false;
           cout <<"Invalid Commmand\n";
           info();
         }
@@ -103,5 +168,10 @@ int main(int argc, char* argv[]){
           info();
       }
   
-  return 0;
+  if (traceEnabled) {
+    string label = "minigit";
+    for (int i = 1; i < argc; ++i) label += string(" ") + argv[i];
+    tracer().write(tracePath, label);
+  }
+  return ok ? 0 : 1;
 }
@@ -0,0 +1,142 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+//this file includes the line level three-way merge used by 'minigit merge'
+//both sides are diffed against the merge base; changes that don't touch
+//each other are applied together, changes to the same (or adjacent) base
+//lines are a conflict unless both sides made the same edit
+//only the conflicting lines end up between the markers, lines both sides
+//agree on at the edges of a conflict are moved out of it
+
+//base lines [baseStart, baseEnd) were replaced by side lines [sideStart, sideEnd)
+struct MergeHunk {
+  size_t baseStart, baseEnd;
+  size_t sideStart, sideEnd;
+};
+
+vector<MergeHunk> changeHunks(const DiffInput& base, const DiffInput& side){
+  LineDiff diff(base.ids, side.ids);
+  diff.run();
+  vector<MergeHunk> hunks;
+  size_t n = base.ids.size(), m = side.ids.size();
+  size_t i = 0, j = 0;
+  while (i < n || j < m){
+    if ((i < n && diff.deleted[i]) || (j < m && diff.inserted[j])){
+      MergeHunk hunk = {i, i, j, j};
+      while ((i < n && diff.deleted[i]) || (j < m && diff.inserted[j])){
+        if (i < n && diff.deleted[i]) i++;
+        else j++;
+      }
+      hunk.baseEnd = i;
+      hunk.sideEnd = j;
+      hunks.push_back(hunk);
+    } else {
+      i++;
+      j++;
+    }
+  }
+  return hunks;
+}
+
+static void appendLines(string& out, const DiffInput& input, size_t from, size_t to){
+  for (size_t i = from; i < to; ++i) out.append(input.lines[i].data(), input.lines[i].size());
+}
+
+//a marker has to start on its own line even after a side without a final newline
+static void appendMarker(string& out, const string& marker){
+  if (!out.empty() && out.back() != '\n') out.push_back('\n');
+  out += marker + "\n";
+}
+
+static bool sameLines(const DiffInput& a, size_t aStart, size_t aEnd, const DiffInput& b, size_t bStart, size_t bEnd){
+  return aEnd - aStart == bEnd - bStart && equal(a.ids.begin() + aStart, a.ids.begin() + aEnd, b.ids.begin() + bStart);
+}
+
+//merges ours and theirs against base into out and returns the number of
+//conflicting regions; showBase adds the base lines to each conflict
+//(diff3 style) and keeps lines the sides agree on inside it
+size_t mergeLines(const string_view& baseText, const string_view& oursText, const string_view& theirsText,
+                  const string& oursLabel, const string& theirsLabel, bool showBase, string& out){
+  DiffInput base, ours, theirs;
+  LineTable table;
+  table.split(baseText, base);
+  table.split(oursText, ours);
+  table.split(theirsText, theirs);
+  vector<MergeHunk> oursHunks = changeHunks(base, ours);
+  vector<MergeHunk> theirsHunks = changeHunks(base, theirs);
+
+  size_t conflicts = 0;
+  size_t basePos = 0;
+  //side line = base line + delta outside of hunks
+  int64_t oursDelta = 0, theirsDelta = 0;
+  size_t a = 0, b = 0;
+  while (a < oursHunks.size() || b < theirsHunks.size()){
+    bool oursFirst = b == theirsHunks.size() ||
+                     (a < oursHunks.size() && oursHunks[a].baseStart <= theirsHunks[b].baseStart);
+    size_t low = oursFirst ? oursHunks[a].baseStart : theirsHunks[b].baseStart;
+    size_t high = low;
+    //grow the region while a hunk of either side starts inside it or right
+    //at its end, so edits to adjacent lines are merged by hand too
+    size_t aEnd = a, bEnd = b;
+    bool grew = true;
+    while (grew){
+      grew = false;
+      while (aEnd < oursHunks.size() && oursHunks[aEnd].baseStart <= high){
+        high = max(high, oursHunks[aEnd++].baseEnd);
+        grew = true;
+      }
+      while (bEnd < theirsHunks.size() && theirsHunks[bEnd].baseStart <= high){
+        high = max(high, theirsHunks[bEnd++].baseEnd);
+        grew = true;
+      }
+    }
+
+    appendLines(out, base, basePos, low);
+    size_t oursLow = low + oursDelta, theirsLow = low + theirsDelta;
+    for (size_t i = a; i < aEnd; ++i) oursDelta += int64_t(oursHunks[i].sideEnd - oursHunks[i].sideStart) - int64_t(oursHunks[i].baseEnd - oursHunks[i].baseStart);
+    for (size_t i = b; i < bEnd; ++i) theirsDelta += int64_t(theirsHunks[i].sideEnd - theirsHunks[i].sideStart) - int64_t(theirsHunks[i].baseEnd - theirsHunks[i].baseStart);
+    size_t oursHigh = high + oursDelta, theirsHigh = high + theirsDelta;
+
+    if (bEnd == b){
+      appendLines(out, ours, oursLow, oursHigh);
+    } else if (aEnd == a){
+      appendLines(out, theirs, theirsLow, theirsHigh);
+    } else if (sameLines(ours, oursLow, oursHigh, theirs, theirsLow, theirsHigh)){
+      appendLines(out, ours, oursLow, oursHigh);
+    } else {
+      if (!showBase){
+        while (oursLow < oursHigh && theirsLow < theirsHigh && ours.ids[oursLow] == theirs.ids[theirsLow]){
+          appendLines(out, ours, oursLow, oursLow + 1);
+          oursLow++;
+          theirsLow++;
+        }
+      }
+      size_t suffix = 0;
+      if (!showBase){
+        while (oursHigh - suffix > oursLow && theirsHigh - suffix > theirsLow &&
+               ours.ids[oursHigh - suffix - 1] == theirs.ids[theirsHigh - suffix - 1]) {
+          suffix++;
+        }
+      }
+      appendMarker(out, "<<<<<<< " + oursLabel);
+      appendLines(out, ours, oursLow, oursHigh - suffix);
+      if (showBase){
+        appendMarker(out, "||||||| base");
+        appendLines(out, base, low, high);
+      }
+      appendMarker(out, "=======");
+      appendLines(out, theirs, theirsLow, theirsHigh - suffix);
+      appendMarker(out, ">>>>>>> " + theirsLabel);
+      appendLines(out, ours, oursHigh - suffix, oursHigh);
+      conflicts++;
+    }
+    basePos = high;
+    a = aEnd;
+    b = bEnd;
+  }
+  appendLines(out, base, basePos, base.ids.size());
+  return conflicts;
+}
@@ -0,0 +1,150 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+//this file includes the index of loose objects behind abbreviated ids
+//packs already keep their ids sorted, loose objects are one directory each,
+//so finding the ids that start with a prefix would mean listing objects/
+//instead their ids are kept sorted in a mapped file next to it:
+//  objects.index   "MGLI", u32 version, u32 hash bytes, u32 count,
+//                  i64 mtime of objects/ when it was listed,
+//                  u32 fanout[256] (ids whose first byte is <= i),
+//                  sorted raw ids, one object type byte per id
+//adding or pruning a loose object changes the mtime of objects/, which
+//makes the file stale; it is rebuilt on the next lookup, keeping the types
+//it already knew so only new objects have their header read
+//like the staging index, a listing taken in the same instant as a change
+//to objects/ may have missed it and is never trusted
+
+const char LOOSE_INDEX_MAGIC[4] = {'M', 'G', 'L', 'I'};
+const uint32_t LOOSE_INDEX_VERSION = 1;
+const size_t LOOSE_INDEX_HEADER = 24 + 256 * 4;
+
+class LooseIndex {
+  private:
+    string objectDir;
+    string path;
+    unique_ptr<MappedFile> file;
+    string built;//the contents when this process rebuilt them
+    const char* base = nullptr;
+    int64_t listedMtime = -1;//mtime of objects/ the loaded contents describe
+    int64_t writtenMtime = 0;//mtime of the file holding them
+    uint32_t hashBytes = 0;
+    uint32_t count = 0;
+    const char* fanout = nullptr;
+    const char* ids = nullptr;
+    const char* types = nullptr;
+
+    bool parse(const char* data, size_t size){
+      base = nullptr;
+      count = 0;
+      if (size < LOOSE_INDEX_HEADER || memcmp(data, LOOSE_INDEX_MAGIC, 4) != 0 ||
+          getU32(data + 4) != LOOSE_INDEX_VERSION) {
+        return false;
+      }
+      uint32_t idBytes = getU32(data + 8);
+      uint32_t entries = getU32(data + 12);
+      if (idBytes == 0 || size < LOOSE_INDEX_HEADER + size_t(entries) * (idBytes + 1) ||
+          getU32(data + 24 + 255 * 4) != entries) {
+        return false;
+      }
+      base = data;
+      hashBytes = idBytes;
+      count = entries;
+      listedMtime = int64_t(getU64(data + 16));
+      fanout = data + 24;
+      ids = data + LOOSE_INDEX_HEADER;
+      types = ids + size_t(count) * hashBytes;
+      return true;
+    }
+
+    //type recorded for a raw id, 0 if it isn't in the loaded contents
+    uint8_t knownType(const string& raw) const {
+      if (!base || raw.size() != hashBytes) return 0;
+      uint32_t low, high;
+      findIdPrefixRange(fanout, ids, hashBytes, toHex(reinterpret_cast<const uint8_t*>(raw.data()), raw.size()), low, high);
+      return low < high ? uint8_t(types[low]) : 0;
+    }
+
+    //lists objects/ again and writes the sorted result
+    void rebuild(int64_t dirMtime, size_t idBytes,
+                 const function<vector<pair<string, string>>()>& listLoose,
+                 const function<uint8_t(const string&, const string&)>& readType){
+      TraceScope scope("index loose objects");
+      vector<pair<string, uint8_t>> entries;
+      for (const auto& object : listLoose()){
+        string raw = hexToBytes(object.first);
+        if (raw.size() != idBytes) continue;//ids of another hash, left by a migration
+        uint8_t type = knownType(raw);
+        if (type == 0) type = readType(object.first, object.second);
+        if (type != 0) entries.push_back({raw, type});
+      }
+      sort(entries.begin(), entries.end());
+
+      string out(LOOSE_INDEX_MAGIC, 4);
+      putU32(out, LOOSE_INDEX_VERSION);
+      putU32(out, idBytes);
+      putU32(out, entries.size());
+      putU64(out, uint64_t(dirMtime));
+      uint32_t counts[256] = {0};
+      for (const auto& entry : entries) counts[uint8_t(entry.first[0])]++;
+      uint32_t running = 0;
+      for (int i = 0; i < 256; ++i){
+        running += counts[i];
+        putU32(out, running);
+      }
+      for (const auto& entry : entries) out += entry.first;
+      for (const auto& entry : entries) out.push_back(char(entry.second));
+
+      //the old contents may be what knownType read, so they go only now
+      file.reset();
+      built = move(out);
+      parse(built.data(), built.size());
+      //a read-only repository still resolves ids, it just lists objects/ every time
+      FileStat indexStat;
+      writtenMtime = replaceFile(path, built) && statFile(path, indexStat) ? indexStat.mtimeNs : 0;
+    }
+
+  public:
+    explicit LooseIndex(const string& objectsDir)
+      : objectDir(objectsDir),
+        path(filesystem::path(objectsDir).parent_path().string() + ".index"){}
+
+    //makes the contents describe objects/ as it is now; listLoose gives
+    //every loose object as (hash, file path) and readType the type of one
+    void refresh(size_t idBytes,
+                 const function<vector<pair<string, string>>()>& listLoose,
+                 const function<uint8_t(const string&, const string&)>& readType){
+      FileStat dirStat;
+      if (!statFile(objectDir, dirStat)){
+        file.reset();
+        base = nullptr;
+        return;
+      }
+      if (!base){
+        //even when stale the file knows the types of most objects
+        file.reset(new MappedFile(path));
+        if (!file->ok() || !parse(file->data(), file->size())) file.reset();
+        writtenMtime = 0;
+        FileStat indexStat;
+        if (base && statFile(path, indexStat)) writtenMtime = indexStat.mtimeNs;
+      }
+      if (base && hashBytes == idBytes && listedMtime == dirStat.mtimeNs && listedMtime < writtenMtime) return;
+      rebuild(dirStat.mtimeNs, idBytes, listLoose, readType);
+    }
+
+    //hands every indexed id starting with hexPrefix and its type to visit
+    void findPrefix(const string& hexPrefix, const function<void(const string&, uint8_t)>& visit) const {
+      if (!base || count == 0) return;
+      uint32_t low, high;
+      findIdPrefixRange(fanout, ids, hashBytes, hexPrefix, low, high);
+      for (uint32_t i = low; i < high; ++i){
+        visit(toHex(reinterpret_cast<const uint8_t*>(ids + size_t(i) * hashBytes), hashBytes), uint8_t(types[i]));
+      }
+    }
+};
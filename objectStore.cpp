@@ -0,0 +1,532 @@
+#include <string>
+#include <functional>
+#include <map>
+
+using namespace std;
+
+//this file includes the loose object store
+//every object lives in objects/<hash>/<hash> and starts with a small header:
+//  "MGO" + format byte, type byte, codec byte, varint uncompressed size
+//the payload is the raw content (codec none) or a series of LZ4 blocks of
+//up to OBJECT_BLOCK_SIZE bytes each, every block prefixed by
+//varint(storedLength << 1 | storedRaw)
+//files without the header are objects written before compression existed
+//and are read as raw content
+//lookups check the packs written by gc first and fall back to loose files
+//a large file may be stored as a chunk list (OBJ_CHUNKED, see chunker.cpp);
+//info, stream and read present it as the blob it stands for, so only gc
+//and the store itself ever see the list
+//abbreviated ids are resolved with the sorted ids of the packs and of
+//objectIndex.cpp, so they never list the objects directory
+
+enum ObjectType : uint8_t {
+  OBJ_BLOB = 1,
+  OBJ_COMMIT = 2,
+  OBJ_TREE = 3,
+  OBJ_CHUNKED = 4,
+};
+
+const char* objectTypeName(ObjectType type){
+  switch (type){
+    case OBJ_BLOB: return "blob";
+    case OBJ_COMMIT: return "commit";
+    case OBJ_TREE: return "tree";
+    case OBJ_CHUNKED: return "chunked blob";
+  }
+  return "unknown";
+}
+
+enum ObjectCodec : uint8_t {
+  CODEC_NONE = 0,
+  CODEC_LZ4 = 1,
+};
+
+const char OBJECT_MAGIC[4] = {'M', 'G', 'O', 1};
+const size_t OBJECT_BLOCK_SIZE = 1 << 20;
+//content that doesn't shrink below this fraction of its size is stored raw
+const double OBJECT_MIN_SAVING = 0.9;
+
+struct ObjectInfo {
+  ObjectType type = OBJ_BLOB;
+  ObjectCodec codec = CODEC_NONE;
+  uint64_t size = 0;
+  size_t headerSize = 0;
+  bool chunked = false;//a blob stored as a chunk list, size is the blob's
+};
+
+//parses the header at the start of an object file
+bool parseObjectHeader(const char* data, size_t size, ObjectInfo& info){
+  if (size < 4 || memcmp(data, OBJECT_MAGIC, 4) != 0){
+    info = ObjectInfo();
+    info.size = size;//legacy object, the whole file is the content
+    return true;
+  }
+  ByteReader reader(data + 4, size - 4);
+  info.type = ObjectType(reader.u8());
+  info.codec = ObjectCodec(reader.u8());
+  info.size = reader.varint();
+  info.headerSize = reader.current() - data;
+  return reader.ok() && (info.codec == CODEC_NONE || info.codec == CODEC_LZ4);
+}
+
+//decodes an object held in a buffer owned by `owner` (a loose file or a
+//pack), releasing the mapped pages of each piece once the sink has it
+bool streamEncoded(const char* data, size_t size, const MappedFile& owner,
+                   const function<bool(const char*, size_t)>& sink, ObjectInfo* result){
+  ObjectInfo header;
+  if (!parseObjectHeader(data, size, header)) return false;
+  if (result) *result = header;
+  size_t ownerOffset = data - owner.data();
+
+  if (header.codec == CODEC_NONE){
+    if (size - header.headerSize < header.size) return false;
+    for (uint64_t done = 0; done < header.size;){
+      size_t piece = min<uint64_t>(IO_WINDOW_SIZE, header.size - done);
+      size_t pieceOffset = header.headerSize + done;
+      if (!sink(data + pieceOffset, piece)) return false;
+      owner.release(ownerOffset + pieceOffset, piece);
+      done += piece;
+    }
+    return true;
+  }
+
+  ByteReader reader(data + header.headerSize, size - header.headerSize);
+  vector<char> block(min<uint64_t>(header.size, OBJECT_BLOCK_SIZE));
+  for (uint64_t produced = 0; produced < header.size;){
+    const char* blockStart = reader.current();
+    uint64_t blockHeader = reader.varint();
+    size_t storedSize = blockHeader >> 1;
+    size_t rawSize = min<uint64_t>(OBJECT_BLOCK_SIZE, header.size - produced);
+    const char* stored = reader.take(storedSize);
+    if (!stored) return false;
+    if (blockHeader & 1){
+      if (storedSize != rawSize || !sink(stored, storedSize)) return false;
+    } else {
+      if (!lz4Decompress(stored, storedSize, block.data(), rawSize) || !sink(block.data(), rawSize)) return false;
+    }
+    owner.release(blockStart - owner.data(), reader.current() - blockStart);
+    produced += rawSize;
+  }
+  return true;
+}
+
+//whether the start of an object without a header is a commit, binary or
+//in the text encoding that came before it
+bool isLegacyCommit(const char* data, size_t size){
+  const string textCommit = "commitHash:";
+  return isBinaryCommit(data, size) ||
+         (size >= textCommit.size() && memcmp(data, textCommit.data(), textCommit.size()) == 0);
+}
+
+class ObjectStore {
+  private:
+    string dir;
+    int level = 1;//0 turns compression off
+    mutable PackSet packs;
+    mutable DeltaBaseCache baseCache{DELTA_BASE_CACHE_SIZE};
+    LooseIndex looseIndex;
+
+    string encodeHeader(ObjectType type, ObjectCodec codec, uint64_t size){
+      string header(OBJECT_MAGIC, 4);
+      header.push_back(char(type));
+      header.push_back(char(codec));
+      putVarint(header, size);
+      return header;
+    }
+
+    //compresses one block and appends it with its block header
+    void appendBlock(string& out, const char* data, size_t size){
+      string compressed;
+      lz4Compress(data, size, level, compressed);
+      if (compressed.size() < size){
+        putVarint(out, uint64_t(compressed.size()) << 1);
+        out += compressed;
+      } else {
+        putVarint(out, (uint64_t(size) << 1) | 1);
+        out.append(data, size);
+      }
+    }
+
+    //chooses the codec from the first block so incompressible media isn't
+    //pushed through the compressor block after block
+    ObjectCodec chooseCodec(const char* firstBlock, size_t size, string& encodedFirst){
+      if (level <= 0 || size < 64) return CODEC_NONE;
+      //a fast level 1 pass is enough to recognise incompressible data
+      string compressed;
+      lz4Compress(firstBlock, size, 1, compressed);
+      if (compressed.size() > size * OBJECT_MIN_SAVING) return CODEC_NONE;
+      if (level > 1){
+        compressed.clear();
+        lz4Compress(firstBlock, size, level, compressed);
+      }
+      putVarint(encodedFirst, uint64_t(compressed.size()) << 1);
+      encodedFirst += compressed;
+      return CODEC_LZ4;
+    }
+
+    //rebuilds a delta entry, following its chain down to a full object
+    shared_ptr<const string> resolveDelta(const Pack& pack, const char* data, size_t size, int depth) const {
+      DeltaEntry entry;
+      if (depth > PACK_MAX_CHAIN || !parseDeltaEntry(data, size, pack.idBytes(), entry)) return nullptr;
+      shared_ptr<const string> base = loadContent(toHex(reinterpret_cast<const uint8_t*>(entry.baseHash.data()), entry.baseHash.size()), depth + 1);
+      if (!base) return nullptr;
+      shared_ptr<string> content = make_shared<string>(entry.size, '\0');
+      if (!applyDelta(base->data(), base->size(), entry.delta, entry.deltaSize, &(*content)[0], content->size())) return nullptr;
+      return content;
+    }
+
+    //whole content of an object that is, or may become, a delta base
+    shared_ptr<const string> loadContent(const string& hash, int depth = 0) const {
+      shared_ptr<const string> cached = baseCache.get(hash);
+      traceCount(cached ? TRACE_DELTA_CACHE_HITS : TRACE_DELTA_CACHE_MISSES);
+      if (cached) return cached;
+      const char* data;
+      size_t size;
+      uint8_t kind;
+      const Pack* pack = packs.find(hash, data, size, kind);
+      shared_ptr<const string> content;
+      if (pack && kind == PACK_DELTA){
+        content = resolveDelta(*pack, data, size, depth);
+      } else {
+        shared_ptr<string> full = make_shared<string>();
+        if (read(hash, *full)) content = full;
+      }
+      if (content) baseCache.put(hash, content);
+      return content;
+    }
+
+    //the header of an object as it is stored
+    bool storedInfo(const string& hash, ObjectInfo& result) const {
+      const char* data;
+      size_t size;
+      uint8_t kind;
+      const Pack* pack = packs.find(hash, data, size, kind);
+      if (pack && kind == PACK_DELTA){
+        DeltaEntry entry;
+        if (!parseDeltaEntry(data, size, pack->idBytes(), entry)) return false;
+        result = ObjectInfo();
+        result.type = ObjectType(entry.type);
+        result.size = entry.size;
+        return true;
+      }
+      if (pack){
+        return parseObjectHeader(data, size, result);
+      }
+      MappedFile file(path(hash));
+      return file.ok() && parseObjectHeader(file.data(), file.size(), result);
+    }
+
+    //whether an object already under hash can stand for content of type;
+    //objects without a header predate types and are taken as they are
+    bool storedAs(const string& hash, ObjectType type) const {
+      ObjectInfo stored;
+      if (!storedInfo(hash, stored) || stored.headerSize == 0) return true;
+      ObjectType storedType = stored.type == OBJ_CHUNKED ? OBJ_BLOB : stored.type;
+      if (storedType == type) return true;
+      cout << "Error: object " << hash << " is already stored as a " << objectTypeName(storedType)
+           << ", not a " << objectTypeName(type) << ".\n";
+      return false;
+    }
+
+    //hands the stored content to sink, a chunk list as the list itself
+    bool streamStored(const string& hash, const function<bool(const char*, size_t)>& sink, ObjectInfo* result) const {
+      const char* data;
+      size_t size;
+      uint8_t kind;
+      const Pack* pack = packs.find(hash, data, size, kind);
+      ObjectInfo header;
+      traceCount(TRACE_OBJECTS_READ);
+      if (pack && kind == PACK_DELTA){
+        shared_ptr<const string> content = loadContent(hash);
+        if (!content || !storedInfo(hash, header)) return false;
+        if (result) *result = header;
+        return sink(content->data(), content->size());
+      }
+      if (pack){
+        return streamEncoded(data, size, pack->packFile(), sink, result);
+      }
+      MappedFile file(path(hash));
+      if (!file.ok()) return false;
+      return streamEncoded(file.data(), file.size(), file, sink, result);
+    }
+
+    //the chunks of a chunk list object
+    bool readChunkList(const string& hash, vector<ChunkRef>& chunks, uint64_t& totalSize) const {
+      string list;
+      return streamStored(hash, [&](const char* data, size_t size){
+        list.append(data, size);
+        return true;
+      }, nullptr) && decodeChunkList(list.data(), list.size(), chunks, totalSize);
+    }
+
+  public:
+    explicit ObjectStore(const string& objectDir) : dir(objectDir), packs(objectDir + "pack/"), looseIndex(objectDir){}
+
+    void setCompressionLevel(int compressionLevel){
+      level = max(0, min(compressionLevel, 9));
+    }
+
+    string path(const string& hash) const {
+      return dir + hash + "/" + hash;
+    }
+
+    bool has(const string& hash) const {
+      const char* data;
+      size_t size;
+      uint8_t kind;
+      return packs.find(hash, data, size, kind) || fileExists(path(hash));
+    }
+
+    const string& packDirectory() const {
+      return packs.directory();
+    }
+
+    PackSet& packSet() const {
+      return packs;
+    }
+
+    //every loose object as (hash, file path), including the flat commit
+    //files written before the object store existed
+    vector<pair<string, string>> looseObjects() const {
+      vector<pair<string, string>> found;
+      error_code ec;
+      for (const auto& entry : filesystem::directory_iterator(dir, ec)){
+        string name = entry.path().filename().string();
+        if (hexToBytes(name).empty()) continue;//pack/ and temporary files
+        if (entry.is_directory(ec)){
+          if (fileExists(path(name))) found.push_back({name, path(name)});
+        } else if (entry.is_regular_file(ec)){
+          found.push_back({name, entry.path().string()});
+        }
+      }
+      return found;
+    }
+
+    //type of a loose object from its header; objects written before types
+    //existed are blobs unless they hold a commit, the flat files always do
+    ObjectType looseType(const string& hash, const string& file) const {
+      if (file != path(hash)) return OBJ_COMMIT;
+      MappedFile mapped(file);
+      ObjectInfo header;
+      if (!mapped.ok() || !parseObjectHeader(mapped.data(), mapped.size(), header)) return ObjectType(0);
+      if (header.headerSize == 0 && isLegacyCommit(mapped.data(), mapped.size())) return OBJ_COMMIT;
+      return header.type;
+    }
+
+    //every object whose id starts with hexPrefix, with its type (chunked
+    //files count as blobs); an object both packed and loose is listed once
+    vector<pair<string, ObjectType>> findPrefix(const string& hexPrefix){
+      map<string, ObjectType> found;
+      for (const auto& pack : packs.all()){
+        uint32_t low, high;
+        pack->findPrefix(hexPrefix, low, high);
+        for (uint32_t i = low; i < high; ++i){
+          const char* data;
+          size_t size;
+          uint8_t kind;
+          if (!pack->entryAt(i, data, size, kind)) continue;
+          ObjectInfo header;
+          DeltaEntry entry;
+          if (kind == PACK_DELTA){
+            if (parseDeltaEntry(data, size, pack->idBytes(), entry)) found[pack->hashAt(i)] = ObjectType(entry.type);
+          } else if (parseObjectHeader(data, size, header)){
+            found[pack->hashAt(i)] = header.type;
+          }
+        }
+      }
+      looseIndex.refresh(hashHexLength(activeHashAlgorithm) / 2,
+                         [&](){ return looseObjects(); },
+                         [&](const string& hash, const string& file){ return uint8_t(looseType(hash, file)); });
+      looseIndex.findPrefix(hexPrefix, [&](const string& hash, uint8_t type){
+        found.insert({hash, ObjectType(type)});
+      });
+      for (auto& object : found) if (object.second == OBJ_CHUNKED) object.second = OBJ_BLOB;
+      return vector<pair<string, ObjectType>>(found.begin(), found.end());
+    }
+
+    //encodes an object held in memory the way it is stored on disk
+    void encode(ObjectType type, const char* data, size_t size, string& out){
+      string first;
+      size_t firstSize = min(size, OBJECT_BLOCK_SIZE);
+      ObjectCodec codec = chooseCodec(data, firstSize, first);
+      out = encodeHeader(type, codec, size);
+      if (codec == CODEC_NONE){
+        out.append(data, size);
+      } else {
+        out += first;
+        for (size_t offset = firstSize; offset < size; offset += OBJECT_BLOCK_SIZE){
+          appendBlock(out, data + offset, min(OBJECT_BLOCK_SIZE, size - offset));
+        }
+      }
+    }
+
+    //stores an object held in memory, nothing is done if it already exists
+    bool write(const string& hash, ObjectType type, const char* data, size_t size){
+      if (has(hash)) return storedAs(hash, type);//objects are immutable, no need to rewrite
+      TraceScope scope("write object");
+      traceCount(TRACE_OBJECTS_WRITTEN);
+      string out;
+      encode(type, data, size, out);
+      createDirectory(dir + hash + "/");
+      return writeFile(path(hash), out.data(), out.size(), WRITE_BATCHED) && syncLater(dir + hash);
+    }
+
+    bool write(const string& hash, ObjectType type, const string& content){
+      return write(hash, type, content.data(), content.size());
+    }
+
+    //stores a mapped file block by block so memory stays bounded
+    bool write(const string& hash, ObjectType type, const MappedFile& file){
+      if (has(hash)) return storedAs(hash, type);
+      TraceScope scope("write object");
+      traceCount(TRACE_OBJECTS_WRITTEN);
+      string first;
+      size_t firstSize = min(file.size(), OBJECT_BLOCK_SIZE);
+      ObjectCodec codec = chooseCodec(file.data(), firstSize, first);
+      string header = encodeHeader(type, codec, file.size());
+      createDirectory(dir + hash + "/");
+      FileWriter writer;
+      if (!writer.open(path(hash), codec == CODEC_NONE ? header.size() + file.size() : 0, WRITE_BATCHED) ||
+          !writer.write(header.data(), header.size())) {
+        return false;
+      }
+      bool ok;
+      if (codec == CODEC_NONE){
+        ok = writeMapped(writer, file);
+      } else {
+        ok = writer.write(first.data(), first.size());
+        file.release(0, firstSize);
+        string block;
+        for (size_t offset = firstSize; ok && offset < file.size(); offset += OBJECT_BLOCK_SIZE){
+          size_t size = min(OBJECT_BLOCK_SIZE, file.size() - offset);
+          block.clear();
+          appendBlock(block, file.data() + offset, size);
+          ok = writer.write(block.data(), block.size());
+          file.release(offset, size);
+        }
+      }
+      return writer.close() && ok && syncLater(dir + hash);
+    }
+
+    //the chunks of a blob stored as a chunk list
+    bool chunkList(const string& hash, vector<ChunkRef>& chunks) const {
+      uint64_t totalSize;
+      return readChunkList(hash, chunks, totalSize);
+    }
+
+    //stores a large file as content-defined chunks and a chunk list under
+    //hash; the chunks are hashed and written on pool, and ones already in
+    //the store (from an earlier version or another file) are kept
+    bool writeChunked(const string& hash, const MappedFile& file, const Chunker& chunker, ThreadPool& pool){
+      if (has(hash)) return storedAs(hash, OBJ_BLOB);
+      TraceScope scope("write chunked file");
+      vector<pair<size_t, size_t>> cuts = chunker.split(file.data(), file.size());
+      vector<ChunkRef> chunks(cuts.size());
+      atomic<bool> ok(true);
+      parallelFor(pool, cuts.size(), [&](size_t i){
+        const char* data = file.data() + cuts[i].first;
+        chunks[i].size = cuts[i].second;
+        chunks[i].hash = hashWith(activeHashAlgorithm, data, cuts[i].second);
+        if (!write(chunks[i].hash, OBJ_BLOB, data, cuts[i].second)) ok = false;
+        file.release(cuts[i].first, cuts[i].second);
+      });
+      string list = encodeChunkList(chunks, file.size());
+      return ok && !list.empty() && write(hash, OBJ_CHUNKED, list);
+    }
+
+    //size and type of an object without reading its content
+    bool info(const string& hash, ObjectInfo& result) const {
+      if (!storedInfo(hash, result)) return false;
+      if (result.type != OBJ_CHUNKED) return true;
+      vector<ChunkRef> chunks;
+      uint64_t totalSize;
+      if (!readChunkList(hash, chunks, totalSize)) return false;
+      result = ObjectInfo();
+      result.size = totalSize;
+      result.chunked = true;
+      return true;
+    }
+
+    //the type of an object, 0 when there is none; objects without a header
+    //are told apart by their first bytes, like looseType does
+    ObjectType typeOf(const string& hash) const {
+      ObjectInfo header;
+      if (!info(hash, header)){
+        error_code ec;
+        return filesystem::is_regular_file(dir + hash, ec) ? OBJ_COMMIT : ObjectType(0);
+      }
+      if (header.headerSize > 0 || header.chunked) return header.type;
+      string start;
+      stream(hash, [&](const char* data, size_t size){
+        start.append(data, size);
+        return false;//the first piece is enough
+      });
+      return isLegacyCommit(start.data(), start.size()) ? OBJ_COMMIT : header.type;
+    }
+
+    //hands the decompressed content to sink in pieces of at most one block;
+    //result is filled in before the first piece arrives
+    bool stream(const string& hash, const function<bool(const char*, size_t)>& sink, ObjectInfo* result = nullptr) const {
+      ObjectInfo stored;
+      string list;
+      bool started = false;
+      bool ok = streamStored(hash, [&](const char* data, size_t size){
+        if (stored.type == OBJ_CHUNKED){
+          list.append(data, size);
+          return true;
+        }
+        if (!started && result) *result = stored;
+        started = true;
+        return sink(data, size);
+      }, &stored);
+      if (!ok) return false;
+      if (stored.type != OBJ_CHUNKED){
+        if (result) *result = stored;
+        return true;
+      }
+      //a chunked blob is put back together chunk by chunk
+      vector<ChunkRef> chunks;
+      uint64_t totalSize;
+      if (!decodeChunkList(list.data(), list.size(), chunks, totalSize)) return false;
+      if (result){
+        *result = ObjectInfo();
+        result->size = totalSize;
+        result->chunked = true;
+      }
+      for (const ChunkRef& chunk : chunks){
+        ObjectInfo part;
+        if (!streamStored(chunk.hash, sink, &part) || part.size != chunk.size) return false;
+      }
+      return true;
+    }
+
+    //loads a whole object into memory
+    bool read(const string& hash, string& content, ObjectInfo* result = nullptr) const {
+      content.clear();
+      ObjectInfo header;
+      bool ok = stream(hash, [&](const char* data, size_t size){
+        if (content.empty()) content.reserve(header.size);
+        content.append(data, size);
+        return true;
+      }, &header);
+      if (result) *result = header;
+      return ok;
+    }
+
+    //streams an object into a working file with its final size preallocated,
+    //with error set the failure is stored there instead of printed
+    bool restore(const string& hash, const string& filename, string* error = nullptr) const {
+      ObjectInfo header;
+      if (!info(hash, header)){
+        if (error) *error = "Object " + hash + " not found";
+        return false;
+      }
+      FileWriter writer;
+      if (error) writer.silence();
+      bool ok = writer.open(filename, header.size) &&
+                stream(hash, [&](const char* data, size_t size){ return writer.write(data, size); });
+      ok = writer.close() && ok;
+      if (!ok && error) *error = writer.error().empty() ? "Could not read object " + hash : writer.error();
+      return ok;
+    }
+};
@@ -0,0 +1,371 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <list>
+
+using namespace std;
+
+//this file includes the packfiles written by 'minigit gc'
+//a pack holds many objects in one file so the store doesn't need a
+//directory and an inode per object:
+//  pack-<id>.pack  "MGPK", u32 version, then entries back to back, each a
+//                  kind byte followed by the object in loose encoding
+//  pack-<id>.idx   "MGPI", u32 version, u32 hash bytes, u32 count,
+//                  u32 fanout[256] (objects whose first hash byte is <= i),
+//                  sorted binary hashes, u64 offsets, u64 lengths
+//the fanout narrows a lookup to one hash prefix, a binary search finds
+//the entry and a single access into the mapped pack reads it
+//the .idx is written last, so a pack without one is ignored
+//a delta entry stores the base id, the object type, the rebuilt size and
+//the instructions from delta.cpp; bases are full entries or other deltas
+//in the same pack, chains are kept to pack.depth by gc
+
+const char PACK_MAGIC[4] = {'M', 'G', 'P', 'K'};
+const char PACK_INDEX_MAGIC[4] = {'M', 'G', 'P', 'I'};
+const uint32_t PACK_VERSION = 1;
+const size_t PACK_INDEX_HEADER = 16 + 256 * 4;
+
+enum PackEntryKind : uint8_t {
+  PACK_FULL = 0,
+  PACK_DELTA = 1,
+};
+
+//longer chains than this are treated as corrupt (guards against cycles)
+const int PACK_MAX_CHAIN = 256;
+const size_t DELTA_BASE_CACHE_SIZE = 64 << 20;
+//larger blobs are always stored whole
+const uint64_t PACK_DELTA_MAX_SIZE = 16 << 20;
+
+struct DeltaEntry {
+  string baseHash;//binary
+  uint8_t type = 0;
+  uint64_t size = 0;
+  const char* delta = nullptr;
+  size_t deltaSize = 0;
+};
+
+bool parseDeltaEntry(const char* data, size_t size, uint32_t hashBytes, DeltaEntry& entry){
+  ByteReader reader(data, size);
+  entry.baseHash = reader.bytes(hashBytes);
+  entry.type = reader.u8();
+  entry.size = reader.varint();
+  entry.delta = reader.current();
+  entry.deltaSize = reader.remaining();
+  return reader.ok();
+}
+
+string encodeDeltaHeader(const string& baseBinaryHash, uint8_t type, uint64_t size){
+  string header = baseBinaryHash;
+  header.push_back(char(type));
+  putVarint(header, size);
+  return header;
+}
+
+//recently rebuilt delta objects, least recently used ones are dropped
+//once the total size passes the limit
+class DeltaBaseCache {
+  private:
+    typedef list<pair<string, shared_ptr<const string>>> EntryList;
+    size_t limit;
+    size_t bytes = 0;
+    EntryList entries;//most recent first
+    unordered_map<string, EntryList::iterator> lookup;
+    mutex lock;
+
+  public:
+    explicit DeltaBaseCache(size_t byteLimit) : limit(byteLimit){}
+
+    shared_ptr<const string> get(const string& hash){
+      lock_guard<mutex> guard(lock);
+      auto it = lookup.find(hash);
+      if (it == lookup.end()) return nullptr;
+      entries.splice(entries.begin(), entries, it->second);
+      return it->second->second;
+    }
+
+    void put(const string& hash, const shared_ptr<const string>& content){
+      if (content->size() > limit) return;
+      lock_guard<mutex> guard(lock);
+      if (lookup.count(hash)) return;
+      entries.push_front({hash, content});
+      lookup[hash] = entries.begin();
+      bytes += content->size();
+      while (bytes > limit){
+        bytes -= entries.back().second->size();
+        lookup.erase(entries.back().first);
+        entries.pop_back();
+      }
+    }
+};
+
+//narrows a sorted table of raw ids with a fanout (as in .idx files) to the
+//ids whose hex form starts with hexPrefix, leaving them in [low, high)
+//every id in the range sits between the prefix padded with 0s and with fs,
+//so two binary searches find it without looking at ids outside of it
+void findIdPrefixRange(const char* fanout, const char* ids, uint32_t idBytes, const string& hexPrefix,
+                       uint32_t& low, uint32_t& high){
+  low = high = 0;
+  if (hexPrefix.empty() || hexPrefix.size() > idBytes * 2) return;
+  string padded = hexPrefix.size() % 2 ? hexPrefix + "0" : hexPrefix;
+  string from = hexToBytes(padded);
+  if (hexPrefix.size() % 2) padded.back() = 'f';
+  string to = hexToBytes(padded);
+  if (from.empty() || to.empty()) return;
+  uint8_t firstByte = uint8_t(from[0]), lastByte = uint8_t(to[0]);
+  uint32_t begin = firstByte == 0 ? 0 : getU32(fanout + (firstByte - 1) * 4);
+  uint32_t end = getU32(fanout + lastByte * 4);
+  auto idAt = [&](uint32_t i){ return ids + size_t(i) * idBytes; };
+  low = begin;
+  for (uint32_t right = end; low < right;){
+    uint32_t mid = low + (right - low) / 2;
+    if (memcmp(idAt(mid), from.data(), from.size()) < 0) low = mid + 1;
+    else right = mid;
+  }
+  high = low;
+  for (uint32_t right = end; high < right;){
+    uint32_t mid = high + (right - high) / 2;
+    if (memcmp(idAt(mid), to.data(), to.size()) <= 0) high = mid + 1;
+    else right = mid;
+  }
+}
+
+class Pack {
+  private:
+    unique_ptr<MappedFile> index;
+    unique_ptr<MappedFile> pack;
+    uint32_t hashBytes = 0;
+    uint32_t count = 0;
+    const char* fanout = nullptr;
+    const char* hashes = nullptr;
+    const char* offsets = nullptr;
+    const char* lengths = nullptr;
+
+  public:
+    string name;
+
+    bool open(const string& indexPath, const string& packPath){
+      index.reset(new MappedFile(indexPath));
+      pack.reset(new MappedFile(packPath));
+      if (!index->ok() || !pack->ok() || index->size() < PACK_INDEX_HEADER ||
+          memcmp(index->data(), PACK_INDEX_MAGIC, 4) != 0 ||
+          pack->size() < 8 || memcmp(pack->data(), PACK_MAGIC, 4) != 0) {
+        return false;
+      }
+      const char* data = index->data();
+      if (getU32(data + 4) != PACK_VERSION) return false;
+      hashBytes = getU32(data + 8);
+      count = getU32(data + 12);
+      fanout = data + 16;
+      hashes = data + PACK_INDEX_HEADER;
+      offsets = hashes + size_t(count) * hashBytes;
+      lengths = offsets + size_t(count) * 8;
+      return index->size() >= PACK_INDEX_HEADER + size_t(count) * (hashBytes + 16) &&
+             getU32(fanout + 255 * 4) == count;
+    }
+
+    uint32_t objectCount() const { return count; }
+    uint32_t idBytes() const { return hashBytes; }
+    const MappedFile& packFile() const { return *pack; }
+
+    //finds an object by raw hash, data/size cover the entry without its kind byte
+    bool find(const string& binaryHash, const char*& data, size_t& size, uint8_t& kind) const {
+      if (binaryHash.size() != hashBytes || count == 0) return false;
+      uint8_t first = uint8_t(binaryHash[0]);
+      uint32_t low = first == 0 ? 0 : getU32(fanout + (first - 1) * 4);
+      uint32_t high = getU32(fanout + first * 4);
+      while (low < high){
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = memcmp(hashes + size_t(mid) * hashBytes, binaryHash.data(), hashBytes);
+        if (cmp == 0){
+          uint64_t offset = getU64(offsets + size_t(mid) * 8);
+          uint64_t length = getU64(lengths + size_t(mid) * 8);
+          if (length == 0 || offset + length > pack->size()) return false;
+          kind = uint8_t(pack->data()[offset]);
+          data = pack->data() + offset + 1;
+          size = length - 1;
+          return true;
+        }
+        if (cmp < 0) low = mid + 1;
+        else high = mid;
+      }
+      return false;
+    }
+
+    //positions in sorted order of the objects whose hex id starts with hexPrefix
+    void findPrefix(const string& hexPrefix, uint32_t& low, uint32_t& high) const {
+      if (count == 0){
+        low = high = 0;
+        return;
+      }
+      findIdPrefixRange(fanout, hashes, hashBytes, hexPrefix, low, high);
+    }
+
+    //the entry of the i-th object in sorted order, as find() returns it
+    bool entryAt(uint32_t i, const char*& data, size_t& size, uint8_t& kind) const {
+      if (i >= count) return false;
+      uint64_t offset = getU64(offsets + size_t(i) * 8);
+      uint64_t length = getU64(lengths + size_t(i) * 8);
+      if (length == 0 || offset + length > pack->size()) return false;
+      kind = uint8_t(pack->data()[offset]);
+      data = pack->data() + offset + 1;
+      size = length - 1;
+      return true;
+    }
+
+    //hex hash of the i-th object in sorted order
+    string hashAt(uint32_t i) const {
+      return toHex(reinterpret_cast<const uint8_t*>(hashes + size_t(i) * hashBytes), hashBytes);
+    }
+};
+
+//every pack in objects/pack, loaded on first use
+class PackSet {
+  private:
+    string dir;
+    vector<unique_ptr<Pack>> packs;
+    bool loaded = false;
+    mutable mutex loadLock;
+
+    void loadLocked(){
+      packs.clear();
+      loaded = true;
+      error_code ec;
+      if (!filesystem::is_directory(dir, ec)) return;
+      for (const auto& entry : filesystem::directory_iterator(dir, ec)){
+        if (entry.path().extension() != ".idx") continue;
+        string base = entry.path().stem().string();
+        unique_ptr<Pack> pack(new Pack());
+        pack->name = base;
+        if (pack->open(dir + base + ".idx", dir + base + ".pack")){
+          packs.push_back(move(pack));
+        } else {
+          cout <<"Warning: ignoring damaged pack " <<base <<endl;
+        }
+      }
+    }
+
+  public:
+    explicit PackSet(const string& packDir) : dir(packDir){}
+
+    //picks up packs written or removed since the first lookup
+    void reload(){
+      lock_guard<mutex> guard(loadLock);
+      loadLocked();
+    }
+
+    const vector<unique_ptr<Pack>>& all(){
+      lock_guard<mutex> guard(loadLock);
+      if (!loaded) loadLocked();
+      return packs;
+    }
+
+    const Pack* find(const string& hash, const char*& data, size_t& size, uint8_t& kind){
+      const vector<unique_ptr<Pack>>& current = all();
+      if (current.empty()) return nullptr;
+      string binaryHash = hexToBytes(hash);
+      if (binaryHash.empty()) return nullptr;
+      for (const auto& pack : current){
+        if (pack->find(binaryHash, data, size, kind)) return pack.get();
+      }
+      return nullptr;
+    }
+
+    const string& directory() const { return dir; }
+};
+
+//appends entries to a new pack and writes its index at the end
+class PackWriter {
+  private:
+    struct Entry {
+      string binaryHash;
+      uint64_t offset;
+      uint64_t length;
+    };
+    string dir;
+    string tempPath;
+    FileWriter writer;
+    vector<Entry> entries;
+    uint64_t offset = 0;
+
+  public:
+    bool begin(const string& packDir){
+      dir = packDir;
+      createDirectory(dir);
+      tempPath = dir + "tmp-" + to_string(chrono::steady_clock::now().time_since_epoch().count()) + ".pack";
+      if (!writer.open(tempPath)) return false;
+      string header(PACK_MAGIC, 4);
+      putU32(header, PACK_VERSION);
+      offset = header.size();
+      return writer.write(header.data(), header.size());
+    }
+
+    //the entry is written as kind, prefix, data so a delta header doesn't
+    //need to be copied in front of the instructions
+    bool add(const string& hash, PackEntryKind kind, const char* data, size_t size, const string& prefix = ""){
+      string binaryHash = hexToBytes(hash);
+      if (binaryHash.empty()) return false;
+      char kindByte = char(kind);
+      if (!writer.write(&kindByte, 1) || !writer.write(prefix.data(), prefix.size()) || !writer.write(data, size)) return false;
+      uint64_t length = 1 + prefix.size() + size;
+      entries.push_back({binaryHash, offset, length});
+      offset += length;
+      return true;
+    }
+
+    size_t size() const { return entries.size(); }
+
+    //finishes the pack, packName receives pack-<id> where id hashes the contents
+    bool finish(string& packName){
+      if (!writer.close()) return false;
+      sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){ return a.binaryHash < b.binaryHash; });
+      for (size_t i = 1; i < entries.size(); ++i){
+        if (entries[i].binaryHash == entries[i - 1].binaryHash){
+          cout <<"Error: object added to the pack twice" <<endl;
+          return false;
+        }
+      }
+      uint32_t hashBytes = entries.empty() ? 0 : entries[0].binaryHash.size();
+
+      string index(PACK_INDEX_MAGIC, 4);
+      putU32(index, PACK_VERSION);
+      putU32(index, hashBytes);
+      putU32(index, entries.size());
+      uint32_t fanout[256] = {0};
+      for (const Entry& entry : entries) fanout[uint8_t(entry.binaryHash[0])]++;
+      uint32_t running = 0;
+      for (int i = 0; i < 256; ++i){
+        running += fanout[i];
+        putU32(index, running);
+      }
+      string names;
+      for (const Entry& entry : entries){
+        if (entry.binaryHash.size() != hashBytes){
+          cout <<"Error: objects with different id lengths can't share a pack" <<endl;
+          return false;
+        }
+        index += entry.binaryHash;
+        names += entry.binaryHash;
+      }
+      for (const Entry& entry : entries) putU64(index, entry.offset);
+      for (const Entry& entry : entries) putU64(index, entry.length);
+
+      packName = "pack-" + hashWith(HASH_BLAKE3, names.data(), names.size()).substr(0, 40);
+      error_code ec;
+      filesystem::rename(tempPath, dir + packName + ".pack", ec);
+      if (ec){
+        cout <<"Error: could not move pack into place: " <<ec.message() <<endl;
+        return false;
+      }
+      return syncLater(dir + packName + ".pack") &&
+             writeFile(dir + packName + ".idx", index.data(), index.size(), WRITE_BATCHED);
+    }
+
+    //drops an unfinished pack
+    void abandon(){
+      writer.close();
+      error_code ec;
+      filesystem::remove(tempPath, ec);
+    }
+};
@@ -0,0 +1,110 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <cstring>
+
+using namespace std;
+
+//this file includes the packed-refs file, which holds many refs in one place
+//  "# minigit packed-refs sorted\n", then one "<hash> <refname>\n" line per
+//  ref sorted by refname, e.g. "3fa9... refs/heads/main"
+//the file is memory mapped and searched in place: a lookup bisects the byte
+//range and backs up to the start of a line, so resolving one of 100k refs
+//touches a handful of pages; a loose file under refs/ overrides its entry
+
+const string PACKED_REFS_HEADER = "# minigit packed-refs sorted\n";
+
+class PackedRefs {
+  private:
+    string path;
+    unique_ptr<MappedFile> file;
+    bool loaded = false;
+    const char* first = nullptr;//the first line after the header
+    const char* last = nullptr;
+
+    void load(){
+      loaded = true;
+      first = last = nullptr;
+      if (!fileExists(path)) return;
+      file.reset(new MappedFile(path));
+      if (!file->ok() || file->size() < PACKED_REFS_HEADER.size() ||
+          memcmp(file->data(), PACKED_REFS_HEADER.data(), PACKED_REFS_HEADER.size()) != 0) {
+        cout <<"Warning: ignoring unreadable " <<path <<endl;
+        return;
+      }
+      first = file->data() + PACKED_REFS_HEADER.size();
+      last = file->data() + file->size();
+    }
+
+    //start of the line holding position, never before floor
+    static const char* lineStart(const char* position, const char* floor){
+      while (position > floor && position[-1] != '\n') position--;
+      return position;
+    }
+
+    //splits the line at line into its hash and name, next is the line after it
+    const char* parseLine(const char* line, string_view& hash, string_view& name) const {
+      const char* end = static_cast<const char*>(memchr(line, '\n', last - line));
+      if (!end) end = last;
+      const char* space = static_cast<const char*>(memchr(line, ' ', end - line));
+      if (!space) space = line;
+      hash = string_view(line, space - line);
+      name = space == line ? string_view(line, end - line) : string_view(space + 1, end - space - 1);
+      return end == last ? last : end + 1;
+    }
+
+    //first line whose name is not less than key
+    const char* lowerBound(const string_view& key) const {
+      const char* low = first;
+      const char* high = last;
+      while (low < high){
+        const char* mid = lineStart(low + (high - low) / 2, low);
+        string_view hash, name;
+        const char* next = parseLine(mid, hash, name);
+        if (name < key) low = next;
+        else high = mid;
+      }
+      return low;
+    }
+
+  public:
+    explicit PackedRefs(const string& packedPath) : path(packedPath){}
+
+    //picks up a file rewritten since the first lookup
+    void reload(){
+      file.reset();
+      loaded = false;
+    }
+
+    bool find(const string& refname, string& hash){
+      if (!loaded) load();
+      if (!first) return false;
+      const char* line = lowerBound(refname);
+      if (line >= last) return false;
+      string_view lineHash, name;
+      parseLine(line, lineHash, name);
+      if (name != refname) return false;
+      hash = string(lineHash);
+      return true;
+    }
+
+    //hands every ref whose name starts with prefix to visit, in sorted order
+    void forEach(const string& prefix, const function<void(const string_view& name, const string_view& hash)>& visit){
+      if (!loaded) load();
+      if (!first) return;
+      for (const char* line = lowerBound(prefix); line < last;){
+        string_view hash, name;
+        line = parseLine(line, hash, name);
+        if (name.compare(0, prefix.size(), prefix) != 0) break;
+        visit(name, hash);
+      }
+    }
+};
+
+string encodePackedRefs(const map<string, string>& refs){
+  string out = PACKED_REFS_HEADER;
+  for (const auto& ref : refs) out += ref.second + " " + ref.first + "\n";
+  return out;
+}
@@ -0,0 +1,58 @@
+#include <string>
+#include <sstream>
+#include <map>
+#include <cstdlib>
+
+using namespace std;
+
+//this file includes the repository settings stored as 'key=value' lines
+
+//format versions of the object store
+//  1 - djb2 ids, repositories created before the config file existed
+//  2 - blake3 ids
+const int FORMAT_LEGACY = 1;
+const int FORMAT_CURRENT = 2;
+
+class RepoConfig {
+  private:
+    map<string, string> values;
+
+  public:
+    bool load(const string& path){
+      values.clear();
+      if (!fileExists(path)) return false;
+      stringstream ss(readFile(path));
+      string line;
+      while (getline(ss, line)){
+        size_t eqPos = line.find('=');
+        if (line.empty() || line[0] == '#' || eqPos == string::npos) continue;
+        values[line.substr(0, eqPos)] = line.substr(eqPos + 1);
+      }
+      return true;
+    }
+
+    bool save(const string& path) const {
+      stringstream ss;
+      for (const auto& entry : values){
+        ss << entry.first << "=" << entry.second << "\n";
+      }
+      return replaceFile(path, ss.str());
+    }
+
+    string get(const string& key, const string& fallback = "") const {
+      auto it = values.find(key);
+      return it == values.end() ? fallback : it->second;
+    }
+
+    long getInt(const string& key, long fallback) const {
+      auto it = values.find(key);
+      if (it == values.end() || it->second.empty()) return fallback;
+      char* end = nullptr;
+      long value = strtol(it->second.c_str(), &end, 10);
+      return *end == '\0' ? value : fallback;
+    }
+
+    void set(const string& key, const string& value){
+      values[key] = value;
+    }
+};
@@ -0,0 +1,182 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <atomic>
+
+using namespace std;
+
+//this file includes the worker pool used by the commands that touch many files
+
+//number of workers used when the caller doesn't ask for a specific count
+size_t defaultThreadCount(){
+  size_t count = thread::hardware_concurrency();
+  return count == 0 ? 1 : count;
+}
+
+//set on the workers of every pool; work that could split itself across
+//threads (hashing a large file) runs serially there, since the pool
+//already keeps the cores busy
+thread_local bool onPoolWorker = false;
+
+//every worker owns a deque of tasks: it runs its newest task from the back
+//and, once that is empty, steals the oldest task from the front of another
+//worker's deque; tasks submitted from a worker go to its own deque
+//wait() must not be called from inside a task
+class ThreadPool {
+  private:
+    struct WorkerQueue {
+      mutex lock;
+      deque<function<void()>> tasks;
+    };
+    vector<unique_ptr<WorkerQueue>> queues;
+    vector<thread> workers;
+    mutex lock;
+    condition_variable taskReady;
+    condition_variable allDone;
+    size_t pending;//submitted and not finished
+    size_t queued;//submitted and not started
+    bool stopping;
+    atomic<size_t> nextQueue;
+
+    //index of the calling worker in this pool, queues.size() for other threads
+    size_t currentWorker() const {
+      thread::id self = this_thread::get_id();
+      for (size_t i = 0; i < workers.size(); ++i){
+        if (workers[i].get_id() == self) return i;
+      }
+      return queues.size();
+    }
+
+    bool takeTask(size_t self, function<void()>& task){
+      {
+        WorkerQueue& own = *queues[self];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty()){
+          task = move(own.tasks.back());
+          own.tasks.pop_back();
+          return true;
+        }
+      }
+      for (size_t offset = 1; offset < queues.size(); ++offset){
+        WorkerQueue& victim = *queues[(self + offset) % queues.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty()){
+          task = move(victim.tasks.front());
+          victim.tasks.pop_front();
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void workerLoop(size_t self){
+      onPoolWorker = true;
+      while (true){
+        function<void()> task;
+        if (!takeTask(self, task)){
+          unique_lock<mutex> guard(lock);
+          taskReady.wait(guard, [this]{ return stopping || queued > 0; });
+          if (queued == 0) return;//only reached when stopping
+          continue;//a task is on its way into some deque
+        }
+        {
+          lock_guard<mutex> guard(lock);
+          queued--;
+        }
+        task();
+        {
+          lock_guard<mutex> guard(lock);
+          pending--;
+          if (pending == 0) allDone.notify_all();
+        }
+      }
+    }
+
+  public:
+    explicit ThreadPool(size_t threadCount = 0) : pending(0), queued(0), stopping(false), nextQueue(0){
+      if (threadCount == 0) threadCount = defaultThreadCount();
+      for (size_t i = 0; i < threadCount; ++i) queues.emplace_back(new WorkerQueue());
+      for (size_t i = 0; i < threadCount; ++i){
+        workers.emplace_back([this, i]{ workerLoop(i); });
+      }
+    }
+
+    size_t size() const {
+      return workers.size();
+    }
+
+    void submit(function<void()> task){
+      {
+        lock_guard<mutex> guard(lock);
+        pending++;
+        queued++;
+      }
+      size_t target = currentWorker();
+      if (target == queues.size()) target = nextQueue++ % queues.size();
+      {
+        lock_guard<mutex> guard(queues[target]->lock);
+        queues[target]->tasks.push_back(move(task));
+      }
+      taskReady.notify_one();
+    }
+
+    //blocks until every submitted task has finished
+    void wait(){
+      unique_lock<mutex> guard(lock);
+      allDone.wait(guard, [this]{ return pending == 0; });
+    }
+
+    ~ThreadPool(){
+      {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+      }
+      taskReady.notify_all();
+      for (thread& worker : workers) worker.join();
+    }
+};
+
+//caps the bytes held by tasks in flight; a request larger than the whole
+//budget still runs, but only once nothing else holds any
+class MemoryBudget {
+  private:
+    mutex lock;
+    condition_variable released;
+    uint64_t limit;
+    uint64_t used = 0;
+
+  public:
+    explicit MemoryBudget(uint64_t byteLimit) : limit(byteLimit){}
+
+    void acquire(uint64_t bytes){
+      unique_lock<mutex> guard(lock);
+      released.wait(guard, [&]{ return used == 0 || used + bytes <= limit; });
+      used += bytes;
+    }
+
+    void release(uint64_t bytes){
+      {
+        lock_guard<mutex> guard(lock);
+        used -= bytes;
+      }
+      released.notify_all();
+    }
+};
+
+//runs body(i) for every i in [0, count) spread over the pool's workers
+void parallelFor(ThreadPool& pool, size_t count, const function<void(size_t)>& body){
+  atomic<size_t> next(0);
+  size_t workerCount = min(pool.size(), count);
+  for (size_t w = 0; w < workerCount; ++w){
+    pool.submit([&]{
+      for (size_t i = next++; i < count; i = next++){
+        body(i);
+      }
+    });
+  }
+  pool.wait();
+}
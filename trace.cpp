@@ -0,0 +1,208 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstdio>
+
+using namespace std;
+
+//this file includes the tracing behind '--trace=<file>'
+//a TraceScope records how long a phase took on the thread it ran on and
+//traceCount adds to the counters below; with tracing off both are a single
+//check of traceEnabled, so they can sit on hot paths
+//the trace is written in the Chrome Trace Event format, open it in
+//chrome://tracing or ui.perfetto.dev
+
+enum TraceCounter {
+  TRACE_OBJECTS_READ,
+  TRACE_OBJECTS_WRITTEN,
+  TRACE_BYTES_HASHED,
+  TRACE_FILES_READ,
+  TRACE_BYTES_READ,
+  TRACE_FILES_WRITTEN,
+  TRACE_BYTES_WRITTEN,
+  TRACE_FILES_STATTED,
+  TRACE_STAT_CACHE_HITS,
+  TRACE_DELTA_CACHE_HITS,
+  TRACE_DELTA_CACHE_MISSES,
+  TRACE_COMMITS_PARSED,
+  TRACE_COUNTER_COUNT
+};
+
+const char* const TRACE_COUNTER_NAMES[TRACE_COUNTER_COUNT] = {
+  "objects read", "objects written", "bytes hashed", "files read", "bytes read",
+  "files written", "bytes written", "files statted", "stat cache hits",
+  "delta cache hits", "delta cache misses", "commits parsed"
+};
+
+//set once by main before any work starts
+bool traceEnabled = false;
+
+class Tracer {
+  public:
+    struct Event {
+      const char* name;
+      int64_t start;//ns since the trace started
+      int64_t duration;
+    };
+
+    //events are buffered per thread so recording one takes no lock; the
+    //buffers belong to the tracer and outlive the pool threads
+    struct ThreadBuffer {
+      uint32_t id;
+      int depth = 0;
+      vector<Event> events;
+    };
+
+  private:
+    struct Sample {
+      int64_t time;
+      uint64_t values[TRACE_COUNTER_COUNT];
+    };
+
+    chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+    atomic<uint64_t> counters[TRACE_COUNTER_COUNT] = {};
+    mutex lock;
+    vector<unique_ptr<ThreadBuffer>> threads;
+    vector<Sample> samples;
+
+    static string escape(const string& text){
+      string out;
+      for (char c : text){
+        if (c == '"' || c == '\\') out.push_back('\\');
+        if (uint8_t(c) < 0x20) continue;
+        out.push_back(c);
+      }
+      return out;
+    }
+
+    static string micros(int64_t ns){
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "%lld.%03lld", (long long)(ns / 1000), (long long)(ns % 1000));
+      return buffer;
+    }
+
+  public:
+    int64_t now() const {
+      return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count();
+    }
+
+    ThreadBuffer& currentThread(){
+      thread_local ThreadBuffer* current = nullptr;
+      if (!current){
+        lock_guard<mutex> guard(lock);
+        threads.emplace_back(new ThreadBuffer());
+        current = threads.back().get();
+        current->id = uint32_t(threads.size());
+      }
+      return *current;
+    }
+
+    void count(TraceCounter counter, uint64_t amount){
+      counters[counter].fetch_add(amount, memory_order_relaxed);
+    }
+
+    //snapshots every counter so the trace shows how they grew over time
+    void sampleCounters(){
+      Sample sample;
+      sample.time = now();
+      for (int i = 0; i < TRACE_COUNTER_COUNT; ++i) sample.values[i] = counters[i].load(memory_order_relaxed);
+      lock_guard<mutex> guard(lock);
+      samples.push_back(sample);
+    }
+
+    //writes every recorded event; call it once the work is done
+    bool write(const string& path, const string& label){
+      sampleCounters();
+      lock_guard<mutex> guard(lock);
+      ofstream file(path, ios::binary);
+      if (!file.is_open()){
+        cout <<"Error: Could not open trace file for writing: " <<path <<endl;
+        return false;
+      }
+      file <<"{\"traceEvents\":[\n";
+      file <<"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"" <<escape(label) <<"\"}}";
+      for (const auto& thread : threads){
+        file <<",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" <<thread->id
+             <<",\"args\":{\"name\":\"" <<(thread->id == 1 ? string("main") : "worker " + to_string(thread->id - 1)) <<"\"}}";
+        for (const Event& event : thread->events){
+          file <<",\n{\"name\":\"" <<escape(event.name) <<"\",\"cat\":\"minigit\",\"ph\":\"X\",\"ts\":" <<micros(event.start)
+               <<",\"dur\":" <<micros(event.duration) <<",\"pid\":1,\"tid\":" <<thread->id <<"}";
+        }
+      }
+      //one track per counter, a point only where the value moved
+      for (int i = 0; i < TRACE_COUNTER_COUNT; ++i){
+        for (size_t s = 0; s < samples.size(); ++s){
+          if (s > 0 && s + 1 < samples.size() && samples[s].values[i] == samples[s - 1].values[i]) continue;
+          file <<",\n{\"name\":\"" <<TRACE_COUNTER_NAMES[i] <<"\",\"ph\":\"C\",\"ts\":" <<micros(samples[s].time)
+               <<",\"pid\":1,\"tid\":1,\"args\":{\"value\":" <<samples[s].values[i] <<"}}";
+        }
+      }
+      file <<"\n],\"displayTimeUnit\":\"ms\",\"otherData\":{";
+      for (int i = 0; i < TRACE_COUNTER_COUNT; ++i){
+        file <<(i ? "," : "") <<"\"" <<TRACE_COUNTER_NAMES[i] <<"\":" <<counters[i].load();
+      }
+      file <<"}}\n";
+      file.close();
+      if (!file){
+        cout <<"Error: Could not write trace file: " <<path <<endl;
+        return false;
+      }
+      return true;
+    }
+};
+
+Tracer& tracer(){
+  static Tracer instance;
+  return instance;
+}
+
+//turns tracing on, the calling thread is shown as the main thread
+void startTracing(){
+  traceEnabled = true;
+  tracer().currentThread();
+}
+
+inline void traceCount(TraceCounter counter, uint64_t amount = 1){
+  if (traceEnabled) tracer().count(counter, amount);
+}
+
+//times the enclosing block as one event named after a string literal
+//the outer phases on the main thread also sample the counters
+class TraceScope {
+  private:
+    Tracer::ThreadBuffer* thread = nullptr;
+    const char* name;
+    int64_t start = 0;
+
+  public:
+    explicit TraceScope(const char* scopeName) : name(scopeName){
+      if (!traceEnabled) return;
+      thread = &tracer().currentThread();
+      if (thread->id == 1 && thread->depth == 0) tracer().sampleCounters();
+      thread->depth++;
+      start = tracer().now();
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    //closes the event before the end of the block, for phases that don't
+    //have a block of their own
+    void end(){
+      if (!thread) return;
+      thread->events.push_back({name, start, tracer().now() - start});
+      thread->depth--;
+      if (thread->id == 1 && thread->depth <= 1) tracer().sampleCounters();
+      thread = nullptr;
+    }
+
+    ~TraceScope(){
+      end();
+    }
+};
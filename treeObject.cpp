@@ -0,0 +1,280 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <functional>
+#include <algorithm>
+
+using namespace std;
+
+//this file includes the tree objects, one per directory
+//a tree lists its entries sorted by name, one per line:
+//  "blob <hash> <name>" or "tree <hash> <name>"
+//a directory's id covers everything below it, so two snapshots that share
+//a subdirectory share its tree object and comparing them skips it whole
+
+struct TreeEntry {
+  string name;
+  bool isTree = false;
+  string hash;
+};
+
+//a path that differs between two trees, "" for the side it's missing from
+struct TreeChange {
+  string path;
+  string oldBlob;
+  string newBlob;
+};
+
+string encodeTree(const vector<TreeEntry>& entries){
+  string out;
+  for (const TreeEntry& entry : entries){
+    out += entry.isTree ? "tree " : "blob ";
+    out += entry.hash + " " + entry.name + "\n";
+  }
+  return out;
+}
+
+bool decodeTree(const string& data, vector<TreeEntry>& entries){
+  entries.clear();
+  stringstream ss(data);
+  string line;
+  while (getline(ss, line)){
+    size_t hashEnd = line.find(' ', 5);
+    if (line.size() < 5 || hashEnd == string::npos) return false;
+    TreeEntry entry;
+    entry.isTree = line.compare(0, 5, "tree ") == 0;
+    if (!entry.isTree && line.compare(0, 5, "blob ") != 0) return false;
+    entry.hash = line.substr(5, hashEnd - 5);
+    entry.name = line.substr(hashEnd + 1);
+    entries.push_back(entry);
+  }
+  return true;
+}
+
+bool readTreeEntries(const ObjectStore& objects, const string& treeHash, vector<TreeEntry>& entries){
+  string data;
+  ObjectInfo info;
+  return objects.read(treeHash, data, &info) && info.type == OBJ_TREE && decodeTree(data, entries);
+}
+
+//writes the trees of a path -> blob snapshot bottom up and returns the root
+//id; trees that already exist (unchanged directories) aren't written again
+//the id of every tree, root and subtrees, is added to written when given
+string writeTree(ObjectStore& objects, const unordered_map<string, string>& blobs,
+                 unordered_set<string>* written = nullptr){
+  TraceScope scope("write trees");
+  //directory -> its entries, built from the sorted paths
+  map<string, map<string, TreeEntry>> directories;
+  directories[""];
+  for (const auto& blob : blobs){
+    string path = blob.first;
+    size_t slash = path.rfind('/');
+    string dir = slash == string::npos ? "" : path.substr(0, slash);
+    TreeEntry entry;
+    entry.name = slash == string::npos ? path : path.substr(slash + 1);
+    entry.hash = blob.second;
+    directories[dir][entry.name] = entry;
+    //make sure every ancestor lists the directory below it
+    while (!dir.empty()){
+      size_t parentSlash = dir.rfind('/');
+      string parent = parentSlash == string::npos ? "" : dir.substr(0, parentSlash);
+      TreeEntry sub;
+      sub.name = parentSlash == string::npos ? dir : dir.substr(parentSlash + 1);
+      sub.isTree = true;
+      if (!directories[parent].insert({sub.name, sub}).second) break;
+      dir = parent;
+    }
+  }
+
+  //deepest directories first, so children have their ids before parents
+  vector<string> order;
+  for (const auto& dir : directories) order.push_back(dir.first);
+  sort(order.begin(), order.end(), [](const string& a, const string& b){
+    size_t depthA = count(a.begin(), a.end(), '/') + !a.empty();
+    size_t depthB = count(b.begin(), b.end(), '/') + !b.empty();
+    return depthA != depthB ? depthA > depthB : a < b;
+  });
+  unordered_map<string, string> treeIds;
+  for (const string& dir : order){
+    vector<TreeEntry> entries;
+    for (auto& entry : directories[dir]){
+      if (entry.second.isTree) entry.second.hash = treeIds[dir.empty() ? entry.first : dir + "/" + entry.first];
+      entries.push_back(entry.second);
+    }
+    string data = encodeTree(entries);
+    string id = generateHash("tree", data);
+    if (!objects.write(id, OBJ_TREE, data)) return "";
+    if (written) written->insert(id);
+    treeIds[dir] = id;
+  }
+  return treeIds[""];
+}
+
+//adds every file below a tree to blobs as prefix + relative path
+bool flattenTree(const ObjectStore& objects, const string& treeHash, const string& prefix, unordered_map<string, string>& blobs){
+  vector<TreeEntry> entries;
+  if (!readTreeEntries(objects, treeHash, entries)) return false;
+  for (const TreeEntry& entry : entries){
+    if (entry.isTree){
+      if (!flattenTree(objects, entry.hash, prefix + entry.name + "/", blobs)) return false;
+    } else {
+      blobs[prefix + entry.name] = entry.hash;
+    }
+  }
+  return true;
+}
+
+//the id of the blob or tree at path ("a/b/c") below a tree, "" when
+//nothing is there; only the trees along the path are read
+bool lookupTreePath(const ObjectStore& objects, const string& treeHash, const string& path, string& id){
+  id = "";
+  string current = treeHash;
+  size_t start = 0;
+  while (!current.empty()){
+    size_t slash = path.find('/', start);
+    string name = path.substr(start, slash == string::npos ? string::npos : slash - start);
+    vector<TreeEntry> entries;
+    if (!readTreeEntries(objects, current, entries)) return false;
+    auto entry = lower_bound(entries.begin(), entries.end(), name,
+                             [](const TreeEntry& e, const string& n){ return e.name < n; });
+    if (entry == entries.end() || entry->name != name) return true;
+    if (slash == string::npos){
+      id = entry->hash;
+      return true;
+    }
+    if (!entry->isTree) return true;
+    current = entry->hash;
+    start = slash + 1;
+  }
+  return true;
+}
+
+//every file that differs between two trees ("" for an empty side);
+//subtrees with the same id on both sides are skipped without being read
+bool diffTrees(const ObjectStore& objects, const string& oldTree, const string& newTree, const string& prefix, vector<TreeChange>& changes){
+  if (oldTree == newTree) return true;
+  vector<TreeEntry> oldEntries, newEntries;
+  if ((!oldTree.empty() && !readTreeEntries(objects, oldTree, oldEntries)) ||
+      (!newTree.empty() && !readTreeEntries(objects, newTree, newEntries))) {
+    return false;
+  }
+  //both lists are sorted by name, walk them together
+  size_t i = 0, j = 0;
+  while (i < oldEntries.size() || j < newEntries.size()){
+    const TreeEntry* oldEntry = i < oldEntries.size() ? &oldEntries[i] : nullptr;
+    const TreeEntry* newEntry = j < newEntries.size() ? &newEntries[j] : nullptr;
+    if (oldEntry && newEntry && oldEntry->name != newEntry->name){
+      if (oldEntry->name < newEntry->name) newEntry = nullptr;
+      else oldEntry = nullptr;
+    }
+    if (oldEntry) i++;
+    if (newEntry) j++;
+    string path = prefix + (oldEntry ? oldEntry->name : newEntry->name);
+    string oldTreeId = oldEntry && oldEntry->isTree ? oldEntry->hash : "";
+    string newTreeId = newEntry && newEntry->isTree ? newEntry->hash : "";
+    string oldBlob = oldEntry && !oldEntry->isTree ? oldEntry->hash : "";
+    string newBlob = newEntry && !newEntry->isTree ? newEntry->hash : "";
+    if (!oldTreeId.empty() || !newTreeId.empty()){
+      if (!diffTrees(objects, oldTreeId, newTreeId, path + "/", changes)) return false;
+    }
+    if (oldBlob != newBlob) changes.push_back({path, oldBlob, newBlob});
+  }
+  return true;
+}
+
+//decides a path both sides changed from the base, returns the merged blob
+//or "" when the merge failed
+typedef function<string(const string& path, const string& baseBlob, const string& oursBlob, const string& theirsBlob)> BlobMerger;
+
+//three-way merge of trees by id: a directory one side left alone is taken
+//from the other side whole, only directories both sides changed are read,
+//and only files both sides changed reach the merger
+//resultTree receives the merged tree ("" when it's empty), changes every
+//path whose blob differs from ours, apart from the ones merged by the merger
+//a name that ends up a file on one side and a directory on the other keeps
+//our entry and is added to clashes, a tree can't hold both
+//without write no trees are stored, which lets a first pass collect the
+//files to merge; resultTree is then "" unless a side is taken whole, and
+//empty (when given) tells whether anything is left either way
+bool mergeTrees(ObjectStore& objects, const string& baseTree, const string& oursTree, const string& theirsTree,
+                const string& prefix, const BlobMerger& mergeBlob, string& resultTree, vector<TreeChange>& changes,
+                vector<string>& clashes, bool write = true, bool* empty = nullptr){
+  if (oursTree == theirsTree || theirsTree == baseTree){
+    resultTree = oursTree;
+    if (empty) *empty = resultTree.empty();
+    return true;
+  }
+  if (oursTree == baseTree){
+    resultTree = theirsTree;
+    if (empty) *empty = resultTree.empty();
+    return diffTrees(objects, oursTree, theirsTree, prefix, changes);
+  }
+  //name -> its entries in base, ours and theirs
+  map<string, array<const TreeEntry*, 3>> names;
+  vector<TreeEntry> sides[3];
+  const string* ids[3] = {&baseTree, &oursTree, &theirsTree};
+  for (int side = 0; side < 3; ++side){
+    if (!ids[side]->empty() && !readTreeEntries(objects, *ids[side], sides[side])) return false;
+  }
+  for (int side = 0; side < 3; ++side){
+    for (const TreeEntry& entry : sides[side]){
+      array<const TreeEntry*, 3>& slot = names[entry.name];
+      slot[side] = &entry;
+    }
+  }
+
+  vector<TreeEntry> merged;
+  for (const auto& name : names){
+    string path = prefix + name.first;
+    string blobs[3], trees[3];
+    for (int side = 0; side < 3; ++side){
+      const TreeEntry* entry = name.second[side];
+      if (entry) (entry->isTree ? trees : blobs)[side] = entry->hash;
+    }
+
+    //the same rules for a file and for a directory of that name: a side
+    //that kept the base loses, otherwise both changed it
+    size_t firstChange = changes.size();
+    string blob;
+    if (blobs[1] == blobs[2] || blobs[2] == blobs[0]){
+      blob = blobs[1];
+    } else if (blobs[1] == blobs[0] || blobs[1].empty()){
+      blob = blobs[2];
+      changes.push_back({path, blobs[1], blob});
+    } else if (blobs[2].empty()){
+      blob = blobs[1];//changed here and deleted there keeps our version
+    } else {
+      blob = mergeBlob(path, blobs[0], blobs[1], blobs[2]);
+      if (blob.empty()) return false;
+    }
+
+    string tree;
+    bool noTree;
+    if (!mergeTrees(objects, trees[0], trees[1], trees[2], path + "/", mergeBlob, tree, changes, clashes, write, &noTree)) {
+      return false;
+    }
+    if (!blob.empty() && !noTree){
+      //one side made it a file and the other a directory: ours stays as it is
+      changes.resize(firstChange);
+      clashes.push_back(path);
+      blob = blobs[1];
+      noTree = !blob.empty();
+      tree = trees[1];
+    }
+    if (!blob.empty()) merged.push_back({name.first, false, blob});
+    if (!noTree) merged.push_back({name.first, true, tree});
+  }
+
+  if (empty) *empty = merged.empty();
+  if (merged.empty() || !write){
+    resultTree = "";
+    return true;
+  }
+  string data = encodeTree(merged);
+  resultTree = generateHash("tree", data);
+  return objects.write(resultTree, OBJ_TREE, data);
+}